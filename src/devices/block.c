@@ -3,7 +3,27 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/iosched.h"
+#include "devices/iotrace.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
+
+/** Latency histograms have one bucket per power of 2 TSC cycles. */
+#define HIST_BUCKETS 32
+
+/** Statistics for reads or for writes on a block device. */
+struct op_stats
+  {
+    unsigned long long requests;        /**< Requests completed. */
+    unsigned long long transfers;       /**< Driver calls, after merging. */
+    unsigned long long sectors;         /**< Sectors transferred. */
+    uint64_t wait_cycles;               /**< Time requests spent queued. */
+    uint64_t service_cycles;            /**< Time the driver took. */
+    unsigned long long latency[HIST_BUCKETS];  /**< Submission to
+                                                  completion, by log2. */
+    unsigned long long role_sectors[BLOCK_CNT]; /**< By submitter's role. */
+  };
 
 /** A block device. */
 struct block
@@ -19,15 +39,58 @@ struct block
 
     unsigned long long read_cnt;        /**< Number of sectors read. */
     unsigned long long write_cnt;       /**< Number of sectors written. */
+
+    /** Request queue, served by the device's I/O thread. */
+    struct lock queue_lock;             /**< Protects the members below. */
+    struct condition queue_ready;       /**< Signaled when QUEUE grows. */
+    struct list queue;                  /**< Pending block_requests. */
+    const struct iosched *sched;        /**< Orders QUEUE. */
+    block_sector_t head;                /**< End of the last transfer. */
+    unsigned long long next_seq;        /**< Next request's seq. */
+    bool io_started;                    /**< I/O threads created? */
+    unsigned depth;                     /**< Number of I/O threads. */
+    struct list busy;                   /**< Batches in flight. */
+
+    struct op_stats stats[2];           /**< For reads, then writes. */
+    unsigned long long depth_sum;       /**< Sum of the queue length seen
+                                           by each queued request. */
+    unsigned long long queued_cnt;      /**< Number of queued requests. */
   };
 
+/** A batch of requests that one of a device's I/O threads has
+   passed to the driver. */
+struct io_slot
+  {
+    struct list_elem elem;              /**< Element in the BUSY list. */
+    struct list batch;                  /**< Requests, in disk order. */
+  };
+
+/** Most sectors, and most separate pieces of memory, the I/O
+   thread merges into one transfer. */
+#define MERGE_MAX 256
+#define MERGE_SEGS 32
+
 /** List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
 /** The block block assigned to each Pintos role. */
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
+/** I/O scheduler given to newly registered block devices. */
+static const struct iosched *default_sched = &iosched_clook;
+
+/** Time stamp counter and timer ticks when the first device was
+   registered, to convert cycles into time. */
+static uint64_t boot_tsc;
+static int64_t boot_ticks;
+
+/** Whether block_print_stats() also prints block_print_iostats(). */
+static bool iostats_at_shutdown;
+
 static struct block *list_elem_to_block (struct list_elem *);
+static uint64_t rdtsc (void);
+static void check_range (struct block *, block_sector_t, block_sector_t);
+static void io_thread (void *block_);
 
 /** Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +183,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /** Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -132,11 +193,211 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
    per-block device locking is unneeded. */
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
+{
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/** Verifies that the CNT sectors starting at SECTOR all lie
+   within BLOCK.  Panics if not. */
+static void
+check_range (struct block *block, block_sector_t sector, block_sector_t cnt)
 {
   check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%"PRDSNu", "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt,
+           block->size);
+}
+
+/** Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it move the whole range in a
+   single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     block_sector_t cnt, void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/** Reads consecutive sectors starting at SECTOR from BLOCK into
+   the IOV_CNT pieces of IOV, in order.  Drivers that support it
+   move them all in a single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_readv (struct block *block, block_sector_t sector,
+             const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct block_request r;
+
+  block_request_initv (&r, false, sector, iov, iov_cnt, NULL, NULL);
+  if (r.cnt == 0)
+    return;
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/** Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      block_sector_t cnt, const void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, true, sector, cnt, (void *) buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/** Writes consecutive sectors starting at SECTOR to BLOCK from
+   the IOV_CNT pieces of IOV, in order.  Returns after the block
+   device has acknowledged receiving all of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_writev (struct block *block, block_sector_t sector,
+              const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct block_request r;
+
+  block_request_initv (&r, true, sector, iov, iov_cnt, NULL, NULL);
+  if (r.cnt == 0)
+    return;
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/** Initializes R as a request to read (or write, if WRITE is
+   true) CNT sectors starting at SECTOR into (or from) BUFFER.
+   When it completes, COMPLETE is called with R if it is non-null;
+   otherwise block_wait() on R returns. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, block_sector_t cnt, void *buffer,
+                    void (*complete) (struct block_request *), void *aux)
+{
+  ASSERT (cnt > 0);
+
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->iov = NULL;
+  r->iov_cnt = 0;
+  r->role = BLOCK_CNT;
+  r->complete = complete;
+  r->aux = aux;
+  sema_init (&r->done, 0);
+}
+
+/** Initializes R as a request to read (or write, if WRITE is
+   true) consecutive sectors starting at SECTOR into (or from) the
+   IOV_CNT pieces of IOV, in order.  IOV must stay valid until R
+   completes.  Otherwise like block_request_init(). */
+void
+block_request_initv (struct block_request *r, bool write,
+                     block_sector_t sector,
+                     const struct block_iovec *iov, size_t iov_cnt,
+                     void (*complete) (struct block_request *), void *aux)
+{
+  size_t i;
+
+  r->write = write;
+  r->sector = sector;
+  r->cnt = 0;
+  for (i = 0; i < iov_cnt; i++)
+    r->cnt += iov[i].cnt;
+  r->buffer = NULL;
+  r->iov = iov;
+  r->iov_cnt = iov_cnt;
+  r->role = BLOCK_CNT;
+  r->complete = complete;
+  r->aux = aux;
+  sema_init (&r->done, 0);
+}
+
+/** Queues R on BLOCK and returns without waiting for it.  The
+   device's I/O scheduler decides when R is served, possibly
+   together with adjacent requests.  A request is never served
+   before an earlier overlapping one when either of them writes,
+   so reads always see the data of writes submitted before them. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  check_range (block, r->sector, r->cnt);
+  if (r->write)
+    {
+      ASSERT (block->type != BLOCK_FOREIGN);
+      block->write_cnt += r->cnt;
+    }
+  else
+    block->read_cnt += r->cnt;
+  if (r->role == BLOCK_CNT)
+    {
+      r->role = block->type;
+      r->submit_tsc = rdtsc ();
+      iotrace_record (block, r);
+    }
+
+  if (block->ops->submit != NULL)
+    {
+      block->ops->submit (block->aux, r);
+      return;
+    }
+
+  lock_acquire (&block->queue_lock);
+  if (!block->io_started)
+    {
+      unsigned i;
+
+      block->io_started = true;
+      for (i = 0; i < block->depth; i++)
+        thread_create (block->name, PRI_MAX, io_thread, block);
+    }
+  r->seq = block->next_seq++;
+  block->depth_sum += list_size (&block->queue);
+  block->queued_cnt++;
+  block->sched->add (&block->queue, r);
+  cond_signal (&block->queue_ready, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/** Waits for R, which must have been submitted without a
+   completion function, to complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->complete == NULL);
+  sema_down (&r->done);
+}
+
+/** Makes block devices registered from now on use the I/O
+   scheduler named NAME.  Returns false if there is no such
+   scheduler. */
+bool
+block_set_scheduler (const char *name)
+{
+  const struct iosched *sched = iosched_find (name);
+  if (sched == NULL)
+    return false;
+  default_sched = sched;
+  return true;
 }
 
 /** Returns the number of sectors in BLOCK. */
@@ -176,6 +437,100 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+  if (iostats_at_shutdown)
+    block_print_iostats ();
+}
+
+/** Sets whether the statistics printed at shutdown include the
+   detailed ones from block_print_iostats(). */
+void
+block_set_iostats_at_shutdown (bool enable)
+{
+  iostats_at_shutdown = enable;
+}
+
+/** Prints the statistics of OPS, the reads or writes (as named
+   by OP) of BLOCK.  CYCLES_PER_US converts time stamp counter
+   cycles to microseconds, or is 0 if that is not yet known. */
+static void
+print_op_stats (struct block *block, const char *op,
+                const struct op_stats *ops, uint64_t cycles_per_us)
+{
+  const char *unit = cycles_per_us != 0 ? "us" : "cycles";
+  uint64_t div = cycles_per_us != 0 ? cycles_per_us : 1;
+  int i;
+
+  if (ops->requests == 0)
+    return;
+  printf ("%s: %llu %s in %llu transfers, %llu sectors (",
+          block->name, ops->requests, op, ops->transfers, ops->sectors);
+  print_human_readable_size (ops->sectors * BLOCK_SECTOR_SIZE);
+  printf (")\n");
+  printf ("  average wait %"PRIu64" %s, service %"PRIu64" %s\n",
+          ops->wait_cycles / ops->requests / div, unit,
+          ops->service_cycles / ops->transfers / div, unit);
+  printf ("  latency:");
+  for (i = 0; i < HIST_BUCKETS; i++)
+    if (ops->latency[i] != 0)
+      printf (" <%"PRIu64"%s:%llu", ((uint64_t) 2 << i) / div,
+              unit, ops->latency[i]);
+  printf ("\n  by role:");
+  for (i = 0; i < BLOCK_CNT; i++)
+    if (ops->role_sectors[i] != 0)
+      printf (" %s:%llu", block_type_name (i), ops->role_sectors[i]);
+  printf (" sectors\n");
+}
+
+/** Prints detailed I/O statistics for each block device that has
+   served requests: request and transfer counts, latency
+   histograms, average queue depth, and how the sectors divide
+   among the roles of the devices that submitted them. */
+void
+block_print_iostats (void)
+{
+  uint64_t cycles_per_us = block_cycles_per_us ();
+  struct list_elem *e;
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      if (block->queued_cnt == 0)
+        continue;
+
+      printf ("%s: %s scheduler, average queue depth %llu.%02llu\n",
+              block->name, block->sched->name,
+              block->depth_sum / block->queued_cnt,
+              block->depth_sum * 100 / block->queued_cnt % 100);
+      print_op_stats (block, "reads", &block->stats[0], cycles_per_us);
+      print_op_stats (block, "writes", &block->stats[1], cycles_per_us);
+    }
+}
+
+/** Lets BLOCK have up to DEPTH batches of requests in flight at
+   once, each passed to the driver by an I/O thread of its own,
+   for devices that queue commands themselves.  The driver's
+   functions must then be safe to call concurrently.  Must be
+   called before the first request is submitted to BLOCK. */
+void
+block_set_queue_depth (struct block *block, unsigned depth)
+{
+  ASSERT (!block->io_started);
+  ASSERT (depth > 0);
+  block->depth = depth;
+}
+
+/** Returns the number of time stamp counter cycles per
+   microsecond, as measured since the first device was
+   registered, or 0 if no timer tick has passed since then. */
+uint64_t
+block_cycles_per_us (void)
+{
+  int64_t ticks = timer_ticks () - boot_ticks;
+
+  if (ticks <= 0)
+    return 0;
+  return (rdtsc () - boot_tsc) * TIMER_FREQ / ticks / 1000000;
 }
 
 /** Registers a new block device with the given NAME.  If
@@ -200,6 +555,23 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_ready);
+  list_init (&block->queue);
+  block->sched = default_sched;
+  block->head = 0;
+  block->next_seq = 0;
+  block->io_started = false;
+  block->depth = 1;
+  list_init (&block->busy);
+  memset (block->stats, 0, sizeof block->stats);
+  block->depth_sum = 0;
+  block->queued_cnt = 0;
+  if (boot_tsc == 0)
+    {
+      boot_tsc = rdtsc ();
+      boot_ticks = timer_ticks ();
+    }
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -221,3 +593,254 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+
+/** Request queue. */
+
+/** Returns true if requests A and B access a common sector. */
+static bool
+overlaps (const struct block_request *a, const struct block_request *b)
+{
+  return a->sector < b->sector + b->cnt && b->sector < a->sector + a->cnt;
+}
+
+/** Returns true if R accesses a sector that a batch in flight on
+   BLOCK also accesses, and either of them writes it.  Such a
+   batch is always older, and R must wait for it. */
+static bool
+conflicts_in_flight (struct block *block, struct block_request *r)
+{
+  struct list_elem *e, *f;
+
+  for (e = list_begin (&block->busy); e != list_end (&block->busy);
+       e = list_next (e))
+    {
+      struct io_slot *slot = list_entry (e, struct io_slot, elem);
+      for (f = list_begin (&slot->batch); f != list_end (&slot->batch);
+           f = list_next (f))
+        {
+          struct block_request *o = list_entry (f, struct block_request, elem);
+          if ((o->write || r->write) && overlaps (o, r))
+            return true;
+        }
+    }
+  return false;
+}
+
+/** Returns the oldest request queued on BLOCK that was submitted
+   before R, overlaps it, and reads or writes in conflict with it,
+   or a null pointer if there is none. */
+static struct block_request *
+oldest_conflict (struct block *block, struct block_request *r)
+{
+  struct block_request *oldest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *o = list_entry (e, struct block_request, elem);
+      if (o->seq < r->seq && (o->write || r->write) && overlaps (o, r)
+          && (oldest == NULL || o->seq < oldest->seq))
+        oldest = o;
+    }
+  return oldest;
+}
+
+/** Moves the requests BLOCK serves next from its queue to BATCH.
+   The first is the one its scheduler picks, or an older one that
+   must go first.  Any others follow it on disk, so that the batch
+   moves in one transfer.  Their buffers may lie anywhere, up to
+   MERGE_SEGS separate pieces in all.
+
+   Returns false, leaving BATCH empty, if the request that must go
+   first has to wait for a batch still in flight. */
+static bool
+next_batch (struct block *block, struct list *batch)
+{
+  struct block_request *r, *o;
+  block_sector_t end, cnt;
+  uint8_t *buffer_end;
+  size_t segs;
+  bool merged;
+
+  r = block->sched->next (&block->queue, block->head);
+  while ((o = oldest_conflict (block, r)) != NULL)
+    r = o;
+  if (conflicts_in_flight (block, r))
+    return false;
+  list_remove (&r->elem);
+  list_push_back (batch, &r->elem);
+  end = r->sector + r->cnt;
+  block->head = end;
+
+  /* Vectored requests are passed on as they are. */
+  if (r->iov != NULL)
+    return true;
+
+  buffer_end = (uint8_t *) r->buffer + r->cnt * BLOCK_SECTOR_SIZE;
+  cnt = r->cnt;
+  segs = 1;
+  do
+    {
+      struct list_elem *e;
+
+      merged = false;
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        {
+          struct block_request *m = list_entry (e, struct block_request, elem);
+          size_t new_segs = segs + (m->buffer != buffer_end);
+          if (m->sector == end && m->write == r->write && m->iov == NULL
+              && cnt + m->cnt <= MERGE_MAX && new_segs <= MERGE_SEGS
+              && oldest_conflict (block, m) == NULL
+              && !conflicts_in_flight (block, m))
+            {
+              list_remove (&m->elem);
+              list_push_back (batch, &m->elem);
+              end += m->cnt;
+              buffer_end = (uint8_t *) m->buffer + m->cnt * BLOCK_SECTOR_SIZE;
+              cnt += m->cnt;
+              segs = new_segs;
+              merged = true;
+              break;
+            }
+        }
+    }
+  while (merged);
+  block->head = end;
+  return true;
+}
+
+/** Performs the transfer described by SLOT's batch on BLOCK, then
+   completes each of its requests. */
+static void
+dispatch (struct block *block, struct io_slot *slot)
+{
+  struct list *batch = &slot->batch;
+  struct list_elem *e;
+  struct block_request *first
+    = list_entry (list_front (batch), struct block_request, elem);
+  const struct block_operations *ops = block->ops;
+  struct op_stats *stats = &block->stats[first->write];
+  struct block_iovec segs[MERGE_SEGS];
+  const struct block_iovec *iov;
+  size_t iov_cnt, i;
+  uint64_t start, end;
+
+  if (first->iov != NULL)
+    {
+      iov = first->iov;
+      iov_cnt = first->iov_cnt;
+    }
+  else
+    {
+      /* Gather the requests' buffers, joining adjacent ones. */
+      iov = segs;
+      iov_cnt = 0;
+      for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request, elem);
+          struct block_iovec *last = iov_cnt > 0 ? &segs[iov_cnt - 1] : NULL;
+          if (last != NULL
+              && (uint8_t *) last->buffer + last->cnt * BLOCK_SECTOR_SIZE
+                 == r->buffer)
+            last->cnt += r->cnt;
+          else
+            {
+              ASSERT (iov_cnt < MERGE_SEGS);
+              segs[iov_cnt].buffer = r->buffer;
+              segs[iov_cnt].cnt = r->cnt;
+              iov_cnt++;
+            }
+        }
+    }
+
+  start = rdtsc ();
+  if (first->write && ops->writev != NULL)
+    ops->writev (block->aux, first->sector, iov, iov_cnt);
+  else if (!first->write && ops->readv != NULL)
+    ops->readv (block->aux, first->sector, iov, iov_cnt);
+  else
+    {
+      block_sector_t sector = first->sector, j;
+      for (i = 0; i < iov_cnt; i++)
+        for (j = 0; j < iov[i].cnt; j++, sector++)
+          {
+            uint8_t *buffer = (uint8_t *) iov[i].buffer + j * BLOCK_SECTOR_SIZE;
+            if (first->write)
+              ops->write (block->aux, sector, buffer);
+            else
+              ops->read (block->aux, sector, buffer);
+          }
+    }
+
+  end = rdtsc ();
+
+  /* Account for the batch and take it out of flight, letting
+     requests that conflict with it go. */
+  lock_acquire (&block->queue_lock);
+  stats->transfers++;
+  stats->service_cycles += end - start;
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      uint64_t latency = end - r->submit_tsc;
+      int bucket = 0;
+
+      while (bucket < HIST_BUCKETS - 1 && latency >> (bucket + 1) != 0)
+        bucket++;
+      stats->requests++;
+      stats->sectors += r->cnt;
+      stats->wait_cycles += start - r->submit_tsc;
+      stats->latency[bucket]++;
+      stats->role_sectors[r->role] += r->cnt;
+    }
+  list_remove (&slot->elem);
+  if (block->depth > 1)
+    cond_broadcast (&block->queue_ready, &block->queue_lock);
+  lock_release (&block->queue_lock);
+
+  /* A waiter may free its request as soon as it wakes up. */
+  while (!list_empty (batch))
+    {
+      struct block_request *r
+        = list_entry (list_pop_front (batch), struct block_request, elem);
+
+      if (r->complete != NULL)
+        r->complete (r);
+      else
+        sema_up (&r->done);
+    }
+}
+
+/** Thread that serves the request queue of BLOCK_, one batch of
+   adjacent requests at a time.  A device may have several, as
+   set by block_set_queue_depth(). */
+static void
+io_thread (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct io_slot slot;
+
+      list_init (&slot.batch);
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue) || !next_batch (block, &slot.batch))
+        cond_wait (&block->queue_ready, &block->queue_lock);
+      list_push_back (&block->busy, &slot.elem);
+      lock_release (&block->queue_lock);
+
+      dispatch (block, &slot);
+    }
+}
+
+/** Returns the processor's time stamp counter. */
+static uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /** Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,11 +55,71 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                           const void *);
+
+/** One piece of a scatter-gather buffer. */
+struct block_iovec
+  {
+    void *buffer;                       /**< CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_sector_t cnt;                 /**< Number of sectors. */
+  };
+
+void block_readv (struct block *, block_sector_t,
+                  const struct block_iovec *, size_t iov_cnt);
+void block_writev (struct block *, block_sector_t,
+                   const struct block_iovec *, size_t iov_cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/** Asynchronous requests. */
+
+/** A request to read or write a run of sectors.  Once submitted,
+   it belongs to the block layer until it completes, so it and its
+   buffer must stay valid until then. */
+struct block_request
+  {
+    struct list_elem elem;              /**< Element in a device queue. */
+    bool write;                         /**< Write (true) or read (false). */
+    block_sector_t sector;              /**< First sector. */
+    block_sector_t cnt;                 /**< Number of sectors. */
+    void *buffer;                       /**< CNT * BLOCK_SECTOR_SIZE bytes. */
+    const struct block_iovec *iov;      /**< If nonnull, used instead of
+                                           BUFFER. */
+    size_t iov_cnt;                     /**< Number of pieces in IOV. */
+
+    /** Called in the device's I/O thread when the request
+       completes, so it must not wait for block I/O itself.  If
+       null, DONE is up'd instead. */
+    void (*complete) (struct block_request *);
+    void *aux;                          /**< For use by COMPLETE. */
+    struct semaphore done;              /**< For block_wait(). */
+
+    unsigned long long seq;             /**< Submission order. */
+    enum block_type role;               /**< Type of the device it was
+                                           first submitted to. */
+    uint64_t submit_tsc;                /**< Time of submission. */
+  };
+
+void block_request_init (struct block_request *, bool write, block_sector_t,
+                         block_sector_t cnt, void *buffer,
+                         void (*complete) (struct block_request *),
+                         void *aux);
+void block_request_initv (struct block_request *, bool write, block_sector_t,
+                          const struct block_iovec *, size_t iov_cnt,
+                          void (*complete) (struct block_request *),
+                          void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+bool block_set_scheduler (const char *name);
+
 /** Statistics. */
 void block_print_stats (void);
+void block_print_iostats (void);
+void block_set_iostats_at_shutdown (bool);
+uint64_t block_cycles_per_us (void);
 
 /** Lower-level interface to block device drivers. */
 
@@ -65,10 +127,25 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /** Optional.  Transfer consecutive sectors, starting at the
+       given one, to or from the IOV_CNT pieces of IOV in order,
+       using as few device commands as possible.  If null, the
+       block layer falls back to one sector at a time. */
+    void (*readv) (void *aux, block_sector_t,
+                   const struct block_iovec *iov, size_t iov_cnt);
+    void (*writev) (void *aux, block_sector_t,
+                    const struct block_iovec *iov, size_t iov_cnt);
+
+    /** Optional.  Passes a submitted request on to another device
+       rather than queueing it here, e.g. from a partition to the
+       disk that holds it.  May change the request's SECTOR. */
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_set_queue_depth (struct block *, unsigned depth);
 
 #endif /**< devices/block.h */
@@ -5,10 +5,12 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /** The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +36,7 @@
 #define STA_BSY 0x80            /**< Busy. */
 #define STA_DRDY 0x40           /**< Device Ready. */
 #define STA_DRQ 0x08            /**< Data Request. */
+#define STA_ERR 0x01            /**< Error. */
 
 /** Control Register bits. */
 #define CTL_SRST 0x04           /**< Software Reset. */
@@ -49,6 +52,54 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /**< IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /**< READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /**< WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /**< READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /**< WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /**< SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /**< READ DMA. */
+#define CMD_WRITE_DMA 0xca              /**< WRITE DMA. */
+
+/** Most sectors a single READ or WRITE command can move.  The
+   Sector Count register holds 0 for this many. */
+#define MAX_SECTOR_CNT 256
+
+/** Bus master IDE port addresses, relative to the channel's
+   bus master base.  See [SFF-8038i]. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /**< Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /**< Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /**< PRD table. */
+
+/** Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /**< Start/stop bus master transfer. */
+#define BM_CMD_READ 0x08        /**< 1=write to memory, 0=read from it. */
+
+/** Bus master Status Register bits. */
+#define BM_STA_ACTIVE 0x01      /**< Transfer in progress. */
+#define BM_STA_ERROR 0x02       /**< Transfer failed (write 1 to clear). */
+#define BM_STA_INTR 0x04        /**< Drive interrupted (write 1 to clear). */
+
+/** A physical region descriptor.  A table of these describes the
+   memory a bus master transfer reads or writes.  Each region
+   must not cross a 64 kB boundary, and a byte count of 0 means
+   64 kB. */
+struct prd
+  {
+    uint32_t addr;              /**< Physical address. */
+    uint16_t size;              /**< Byte count. */
+    uint16_t flags;             /**< PRD_EOT in the last entry. */
+  };
+
+#define PRD_EOT 0x8000          /**< End of table. */
+
+/** Entries in each channel's PRD table.  A transfer whose pieces
+   need more falls back to PIO. */
+#define PRD_CNT 64
+
+/** A position within a scatter-gather list. */
+struct iov_cursor
+  {
+    const struct block_iovec *iov;      /**< Current piece. */
+    block_sector_t ofs;                 /**< Sectors of it already used. */
+  };
 
 /** An ATA device. */
 struct ata_disk
@@ -57,6 +108,9 @@ struct ata_disk
     struct channel *channel;    /**< Channel that disk is attached to. */
     int dev_no;                 /**< Device 0 or 1 for master or slave. */
     bool is_ata;                /**< Is device an ATA disk? */
+    int multiple;               /**< Sectors per DRQ block for READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
+    bool dma;                   /**< Use bus master DMA? */
   };
 
 /** An ATA channel (aka controller).
@@ -73,35 +127,68 @@ struct channel
     struct semaphore completion_wait;   /**< Up'd by interrupt handler. */
 
     struct ata_disk devices[2];     /**< The devices on this channel. */
+
+    unsigned long long cmd_cnt;     /**< Commands issued. */
+    unsigned long long overlap_cnt; /**< Commands issued while the other
+                                       channel was busy. */
+
+    uint16_t bm_base;           /**< Bus master base port, or 0 if none. */
+    struct prd prdt[PRD_CNT]    /**< PRD table, aligned so that it does */
+      __attribute__ ((aligned (512)));  /**< not cross 64 kB. */
   };
 
 /** We support the two "legacy" ATA channels found in a standard PC. */
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/** Number of channels with a transfer in progress, and time spent
+   with more than one busy.  Show how much I/O the channels
+   overlap. */
+static int busy_channels;
+static int64_t overlap_start;
+static int64_t overlap_ticks;
+
 static struct block_operations ide_operations;
 
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int max);
+static uint16_t find_bus_master (void);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t,
+                           block_sector_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, block_sector_t cnt);
+static void output_sectors (struct channel *, const void *,
+                            block_sector_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static void ide_transfer (struct ata_disk *, block_sector_t,
+                          const struct block_iovec *, size_t iov_cnt,
+                          bool write);
+static bool dma_transfer (struct ata_disk *, block_sector_t,
+                          block_sector_t cnt, struct iov_cursor *,
+                          bool write);
+static void pio_transfer (struct ata_disk *, block_sector_t,
+                          block_sector_t cnt, struct iov_cursor *,
+                          bool write);
+static uint8_t *iov_take (struct iov_cursor *, block_sector_t max,
+                          block_sector_t *cnt);
+
 static void interrupt_handler (struct intr_frame *);
+static void channel_busy (bool busy);
 
 /** Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
   size_t chan_no;
+  uint16_t bm_base = find_bus_master ();
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
@@ -123,8 +210,10 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
       lock_init (&c->lock);
       c->expecting_interrupt = false;
+      c->cmd_cnt = c->overlap_cnt = 0;
       sema_init (&c->completion_wait, 0);
  
       /* Initialize devices. */
@@ -136,6 +225,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -155,6 +246,47 @@ ide_init (void)
     }
 }
 
+/** Locates a PCI IDE controller capable of bus mastering and
+   enables it as a bus master.  Returns the base port of its bus
+   master registers, or 0 if there is none, in which case all
+   transfers use PIO. */
+static uint16_t
+find_bus_master (void)
+{
+  pci_addr_t addr;
+  uint16_t base;
+
+  /* Class 1 (mass storage), subclass 1 (IDE).  Bit 7 of the
+     programming interface byte says whether it can bus master. */
+  if (!pci_find_class (0x01, 0x01, &addr)
+      || !(pci_read_config (addr, PCI_REG_CLASS) & 0x8000))
+    return 0;
+  base = pci_io_bar (addr, 4);
+  if (base == 0)
+    return 0;
+
+  pci_write_config (addr, PCI_REG_COMMAND,
+                    pci_read_config (addr, PCI_REG_COMMAND)
+                    | PCI_CMD_IO | PCI_CMD_MASTER);
+  return base;
+}
+
+/** Prints statistics on how much the ATA channels overlapped
+   their transfers. */
+void
+ide_print_stats (void)
+{
+  struct channel *c;
+
+  for (c = channels; c < channels + CHANNEL_CNT; c++)
+    if (c->cmd_cnt > 0)
+      printf ("%s: %llu commands, %llu while another channel was busy\n",
+              c->name, c->cmd_cnt, c->overlap_cnt);
+  if (overlap_ticks > 0)
+    printf ("ide: %"PRId64" ticks with more than one channel busy\n",
+            overlap_ticks);
+}
+
 /** Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -279,7 +411,7 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -303,12 +435,44 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Word 47 gives the most sectors the disk can move per DRQ
+     block with READ/WRITE MULTIPLE, or 0 if it lacks them. */
+  set_multiple_mode (d, (uint8_t) id[47 * 2]);
+
+  /* Bit 8 of word 49 says whether the disk supports DMA. */
+  d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/** Enables READ/WRITE MULTIPLE on disk D with the largest power
+   of two not above MAX sectors per DRQ block.  Leaves D in
+   single-sector mode if MAX is 0 or the disk rejects the
+   command. */
+static void
+set_multiple_mode (struct ata_disk *d, int max)
+{
+  struct channel *c = d->channel;
+  int cnt;
+
+  d->multiple = 0;
+  if (max == 0)
+    return;
+  for (cnt = 1; cnt * 2 <= max; cnt *= 2)
+    continue;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple = cnt;
+}
+
 /** Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +501,243 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/** Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/** Reads consecutive sectors starting at SEC_NO from disk D into
+   the IOV_CNT pieces of IOV.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_readv (void *d, block_sector_t sec_no,
+           const struct block_iovec *iov, size_t iov_cnt)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_transfer (d, sec_no, iov, iov_cnt, false);
 }
 
-/** Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+/** Writes consecutive sectors starting at SEC_NO to disk D from
+   the IOV_CNT pieces of IOV.  Returns after the disk has
    acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_writev (void *d, block_sector_t sec_no,
+            const struct block_iovec *iov, size_t iov_cnt)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ide_transfer (d, sec_no, iov, iov_cnt, true);
+}
+
+/** Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  struct block_iovec iov = {buffer, 1};
+  ide_transfer (d, sec_no, &iov, 1, false);
+}
+
+/** Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  struct block_iovec iov = {(void *) buffer, 1};
+  ide_transfer (d, sec_no, &iov, 1, true);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_readv,
+    ide_writev,
+    NULL
   };
-
+
+/** Transfers. */
+
+/** Moves consecutive sectors starting at SEC_NO between disk D
+   and the IOV_CNT pieces of IOV, writing to the disk if WRITE is
+   true.  Each command moves up to MAX_SECTOR_CNT sectors, by bus
+   master DMA if the disk and controller support it and otherwise
+   by PIO. */
+static void
+ide_transfer (struct ata_disk *d, block_sector_t sec_no,
+              const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  struct channel *c = d->channel;
+  struct iov_cursor cur = {iov, 0};
+  block_sector_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < iov_cnt; i++)
+    cnt += iov[i].cnt;
+
+  lock_acquire (&c->lock);
+  channel_busy (true);
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < MAX_SECTOR_CNT ? cnt : MAX_SECTOR_CNT;
+      struct iov_cursor start = cur;
+      c->cmd_cnt++;
+      if (busy_channels > 1)
+        c->overlap_cnt++;
+      if (!d->dma || !dma_transfer (d, sec_no, n, &cur, write))
+        {
+          cur = start;
+          pio_transfer (d, sec_no, n, &cur, write);
+        }
+      sec_no += n;
+      cnt -= n;
+    }
+  channel_busy (false);
+  lock_release (&c->lock);
+}
+
+/** Moves CNT sectors, at most MAX_SECTOR_CNT, starting at SEC_NO
+   between disk D and the pieces at CUR in PIO mode, writing to
+   the disk if WRITE is true, and advances CUR past them.  Takes
+   one interrupt per DRQ block: D->multiple sectors in multiple
+   mode, otherwise a single sector.  D's channel must be
+   locked. */
+static void
+pio_transfer (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt,
+              struct iov_cursor *cur, bool write)
+{
+  struct channel *c = d->channel;
+  block_sector_t per_drq = d->multiple > 0 ? (block_sector_t) d->multiple : 1;
+  block_sector_t done, left, piece;
+
+  select_sector (d, sec_no, cnt);
+  if (write)
+    issue_pio_command (c, d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                          : CMD_WRITE_SECTOR_RETRY);
+  else
+    issue_pio_command (c, d->multiple > 0 ? CMD_READ_MULTIPLE
+                                          : CMD_READ_SECTOR_RETRY);
+  for (done = 0; done < cnt; done += per_drq)
+    {
+      block_sector_t chunk = cnt - done < per_drq ? cnt - done : per_drq;
+      if (!write)
+        sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, write ? "write" : "read", sec_no + done);
+      for (left = chunk; left > 0; left -= piece)
+        {
+          uint8_t *p = iov_take (cur, left, &piece);
+          if (write)
+            output_sectors (c, p, piece);
+          else
+            input_sectors (c, p, piece);
+        }
+      if (write)
+        sema_down (&c->completion_wait);
+    }
+}
+
+/** Moves CNT sectors, at most MAX_SECTOR_CNT, starting at SEC_NO
+   between disk D and the pieces at CUR by bus master DMA, writing
+   to the disk if WRITE is true, and advances CUR past them.  The
+   pieces must be kernel virtual addresses, so that each is
+   physically contiguous.  The calling thread sleeps until the
+   transfer completes.  D's channel must be locked.
+
+   Returns true if successful.  Returns false if the pieces need
+   more than PRD_CNT descriptors, so that the caller can use PIO
+   instead; or if the transfer fails, in which case DMA is also
+   disabled for D. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt,
+              struct iov_cursor *cur, bool write)
+{
+  struct channel *c = d->channel;
+  block_sector_t left, piece;
+  uint8_t bm_status;
+  int i = 0;
+
+  /* Describe the pieces, split at 64 kB boundaries. */
+  for (left = cnt; left > 0; left -= piece)
+    {
+      uintptr_t phys = vtop (iov_take (cur, left, &piece));
+      size_t bytes = piece * BLOCK_SECTOR_SIZE;
+      while (bytes > 0)
+        {
+          size_t size = 0x10000 - (phys & 0xffff);
+          if (size > bytes)
+            size = bytes;
+          if (i == PRD_CNT)
+            return false;
+          c->prdt[i].addr = phys;
+          c->prdt[i].size = size & 0xffff;
+          c->prdt[i].flags = 0;
+          i++;
+          phys += size;
+          bytes -= size;
+        }
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+
+  /* Load the table, set the direction, and clear stale status. */
+  outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_status (c), BM_STA_ERROR | BM_STA_INTR);
+
+  /* Start the drive, then the controller, and sleep until the
+     drive interrupts at the end of the transfer. */
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+  outb (reg_bm_status (c), BM_STA_ERROR | BM_STA_INTR);
+  wait_while_busy (d);
+  if ((bm_status & (BM_STA_ERROR | BM_STA_ACTIVE)) != 0
+      || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    {
+      printf ("%s: DMA transfer failed, falling back to PIO\n", d->name);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
+/** Returns the next run of up to MAX sectors of memory at CUR,
+   storing its length into *CNT, and advances CUR past it.  The
+   run ends early at the end of a piece.  At least one sector must
+   remain at CUR. */
+static uint8_t *
+iov_take (struct iov_cursor *cur, block_sector_t max, block_sector_t *cnt)
+{
+  uint8_t *p;
+
+  while (cur->ofs == cur->iov->cnt)
+    {
+      cur->iov++;
+      cur->ofs = 0;
+    }
+  *cnt = cur->iov->cnt - cur->ofs;
+  if (*cnt > max)
+    *cnt = max;
+  p = (uint8_t *) cur->iov->buffer + cur->ofs * BLOCK_SECTOR_SIZE;
+  cur->ofs += *cnt;
+  return p;
+}
+
 /** Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT, which must be between 1
+   and MAX_SECTOR_CNT, to the disk's sector selection registers.
+   (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_SECTOR_CNT);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTOR_CNT ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -402,7 +746,8 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 }
 
 /** Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Also used to start DMA commands, which
+   complete with the same interrupt. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
@@ -414,20 +759,22 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/** Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/** Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, block_sector_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/** Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/** Writes CNT sectors from SECTORS to channel C's data register in
+   PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, block_sector_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /** Low-level ATA primitives. */
@@ -502,6 +849,19 @@ select_device_wait (const struct ata_disk *d)
   wait_until_idle (d);
 }
 
+/** Records that the calling thread's channel has started (if
+   BUSY) or finished a transfer. */
+static void
+channel_busy (bool busy)
+{
+  enum intr_level old_level = intr_disable ();
+  if (busy && ++busy_channels == 2)
+    overlap_start = timer_ticks ();
+  else if (!busy && busy_channels-- == 2)
+    overlap_ticks += timer_ticks () - overlap_start;
+  intr_set_level (old_level);
+}
+
 /** ATA interrupt handler. */
 static void
 interrupt_handler (struct intr_frame *f) 
@@ -0,0 +1,81 @@
+#include "devices/iosched.h"
+#include <debug.h>
+#include <string.h>
+
+/** C-LOOK.
+
+   Keeps the queue sorted by sector and sweeps it in one
+   direction: the next request is the first at or past the head,
+   wrapping around to the lowest sector after the highest.
+   Requests for the same sector stay in submission order. */
+
+static bool
+sector_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+
+  return a->sector < b->sector;
+}
+
+static void
+clook_add (struct list *queue, struct block_request *r)
+{
+  struct list_elem *e;
+
+  /* Insert after any request for the same sector. */
+  for (e = list_begin (queue); e != list_end (queue); e = list_next (e))
+    if (sector_less (&r->elem, e, NULL))
+      break;
+  list_insert (e, &r->elem);
+}
+
+static struct block_request *
+clook_next (struct list *queue, block_sector_t head)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (queue); e != list_end (queue); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector >= head)
+        return r;
+    }
+  return list_entry (list_front (queue), struct block_request, elem);
+}
+
+const struct iosched iosched_clook = {"clook", clook_add, clook_next};
+
+/** FIFO.
+
+   Serves requests in the order they were submitted, as the
+   disk driver did before requests were queued. */
+
+static void
+fifo_add (struct list *queue, struct block_request *r)
+{
+  list_push_back (queue, &r->elem);
+}
+
+static struct block_request *
+fifo_next (struct list *queue, block_sector_t head UNUSED)
+{
+  return list_entry (list_front (queue), struct block_request, elem);
+}
+
+const struct iosched iosched_fifo = {"fifo", fifo_add, fifo_next};
+
+/** Returns the I/O scheduler named NAME, or a null pointer if
+   there is none. */
+const struct iosched *
+iosched_find (const char *name)
+{
+  static const struct iosched *all[] = {&iosched_clook, &iosched_fifo};
+  size_t i;
+
+  for (i = 0; i < sizeof all / sizeof *all; i++)
+    if (!strcmp (all[i]->name, name))
+      return all[i];
+  return NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef DEVICES_IOSCHED_H
+#define DEVICES_IOSCHED_H
+
+#include <list.h>
+#include "devices/block.h"
+
+/** An I/O scheduler.  Decides the order in which a block device
+   serves the requests queued on it. */
+struct iosched
+  {
+    const char *name;
+
+    /** Adds REQUEST to QUEUE. */
+    void (*add) (struct list *queue, struct block_request *request);
+
+    /** Returns the request in nonempty QUEUE to serve next, given
+       that the previous transfer ended at sector HEAD.  Does not
+       remove it. */
+    struct block_request *(*next) (struct list *queue, block_sector_t head);
+  };
+
+extern const struct iosched iosched_clook;
+extern const struct iosched iosched_fifo;
+
+const struct iosched *iosched_find (const char *name);
+
+#endif /**< devices/iosched.h */
@@ -0,0 +1,221 @@
+#include "devices/iotrace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/** Pages in the ring buffer. */
+#define IOTRACE_PAGES 16
+
+/** Number of records the ring buffer holds. */
+#define RING_CNT (IOTRACE_PAGES * PGSIZE / sizeof (struct iotrace_record))
+
+/** Where to dump the trace, if anywhere. */
+static enum
+  {
+    DEST_NONE,                          /**< Tracing is off. */
+    DEST_CONSOLE,                       /**< Print it in hexadecimal. */
+    DEST_SCRATCH                        /**< Write it to the scratch device. */
+  }
+dest;
+
+static struct iotrace_record *ring;     /**< The most recent RING_CNT records. */
+static uint64_t rec_total;              /**< Number of records ever made. */
+static uint64_t base_tsc;               /**< Submission time of the first. */
+static bool recording;                  /**< Whether to record requests. */
+
+/** Output of dump_bytes(), a sector at a time. */
+static uint8_t out_buf[BLOCK_SECTOR_SIZE];
+static size_t out_ofs;
+static struct block *out_block;         /**< Scratch device, or null for the
+                                           console. */
+static block_sector_t out_sector;
+
+static uint8_t device_index (struct block *);
+static void dump_bytes (const void *, size_t);
+static void dump_flush (void);
+
+/** Turns tracing on, to be dumped at shutdown to DEST, which is
+   "console" (the default, if DEST is null) or "scratch".
+   Returns false if DEST is not recognized.  Called from option
+   parsing; the buffer is only allocated by iotrace_init(). */
+bool
+iotrace_configure (const char *dest_)
+{
+  if (dest_ == NULL || !strcmp (dest_, "console"))
+    dest = DEST_CONSOLE;
+  else if (!strcmp (dest_, "scratch"))
+    dest = DEST_SCRATCH;
+  else
+    return false;
+  return true;
+}
+
+/** Allocates the ring buffer and starts recording, if tracing
+   was turned on by iotrace_configure(). */
+void
+iotrace_init (void)
+{
+  if (dest == DEST_NONE)
+    return;
+
+  ring = palloc_get_multiple (PAL_ZERO, IOTRACE_PAGES);
+  if (ring == NULL)
+    PANIC ("I/O trace: out of memory");
+  recording = true;
+}
+
+/** Records request R on its submission to BLOCK, overwriting the
+   oldest record if the ring buffer is full. */
+void
+iotrace_record (struct block *block, const struct block_request *r)
+{
+  struct iotrace_record *rec;
+  enum intr_level old_level;
+  uint8_t dev;
+  uint64_t time;
+
+  if (!recording)
+    return;
+
+  dev = device_index (block);
+  old_level = intr_disable ();
+  if (rec_total == 0)
+    base_tsc = r->submit_tsc;
+  time = r->submit_tsc > base_tsc ? r->submit_tsc - base_tsc : 0;
+
+  rec = &ring[rec_total++ % RING_CNT];
+  rec->time_lo = time;
+  rec->time_hi = time >> 32;
+  rec->cnt = r->cnt < UINT16_MAX ? r->cnt : UINT16_MAX;
+  rec->sector = r->sector;
+  rec->tid = thread_current ()->tid;
+  rec->dev = dev;
+  rec->flags = ((r->write ? IOTRACE_WRITE : 0)
+                | (r->role << IOTRACE_ROLE_SHIFT & IOTRACE_ROLE_MASK));
+  intr_set_level (old_level);
+}
+
+/** Stops recording and dumps the trace where iotrace_configure()
+   asked, oldest record first.  If the scratch device is missing
+   it goes to the console instead; if it is too small, the oldest
+   records are dropped. */
+void
+iotrace_dump (void)
+{
+  struct iotrace_header h;
+  struct block *block;
+  uint64_t rec_cnt, i;
+
+  if (!recording)
+    return;
+  recording = false;
+
+  out_block = NULL;
+  if (dest == DEST_SCRATCH)
+    {
+      out_block = block_get_role (BLOCK_SCRATCH);
+      if (out_block == NULL)
+        printf ("I/O trace: no scratch device, using console\n");
+    }
+
+  rec_cnt = rec_total < RING_CNT ? rec_total : RING_CNT;
+  if (out_block != NULL)
+    {
+      uint64_t room = (uint64_t) (block_size (out_block) - 1)
+                      * (BLOCK_SECTOR_SIZE / sizeof *ring);
+      if (rec_cnt > room)
+        rec_cnt = room;
+    }
+
+  ASSERT (sizeof h <= IOTRACE_HEADER_SIZE);
+  memset (&h, 0, sizeof h);
+  memcpy (h.magic, IOTRACE_MAGIC, sizeof h.magic);
+  h.version = IOTRACE_VERSION;
+  h.rec_cnt = rec_cnt;
+  h.lost = rec_total - rec_cnt;
+  h.cycles_per_us = block_cycles_per_us ();
+  for (block = block_first (); block != NULL && h.dev_cnt < IOTRACE_DEVS;
+       block = block_next (block))
+    {
+      struct iotrace_device *d = &h.devs[h.dev_cnt++];
+      strlcpy (d->name, block_name (block), sizeof d->name);
+      d->type = block_type (block);
+      d->size = block_size (block);
+    }
+
+  out_ofs = 0;
+  out_sector = 0;
+  dump_bytes (&h, sizeof h);
+  dump_flush ();
+  for (i = rec_total - rec_cnt; i < rec_total; i++)
+    dump_bytes (&ring[i % RING_CNT], sizeof *ring);
+  dump_flush ();
+
+  printf ("I/O trace: %"PRIu64" requests dumped to %s, %"PRIu64" lost\n",
+          rec_cnt, out_block != NULL ? block_name (out_block) : "console",
+          h.lost);
+}
+
+/** Returns BLOCK's position in probe order, as used for the
+   device table in a dump, or UINT8_MAX if it is not in the
+   table. */
+static uint8_t
+device_index (struct block *block)
+{
+  struct block *b;
+  uint8_t i = 0;
+
+  for (b = block_first (); b != NULL && i < IOTRACE_DEVS; b = block_next (b))
+    {
+      if (b == block)
+        return i;
+      i++;
+    }
+  return UINT8_MAX;
+}
+
+/** Appends SIZE bytes from BUFFER to the dump. */
+static void
+dump_bytes (const void *buffer, size_t size)
+{
+  const uint8_t *p = buffer;
+
+  while (size > 0)
+    {
+      size_t chunk = BLOCK_SECTOR_SIZE - out_ofs;
+      if (chunk > size)
+        chunk = size;
+      memcpy (out_buf + out_ofs, p, chunk);
+      out_ofs += chunk;
+      p += chunk;
+      size -= chunk;
+      if (out_ofs == BLOCK_SECTOR_SIZE)
+        dump_flush ();
+    }
+}
+
+/** Writes out the sector in OUT_BUF, padded with zeros,
+   to the scratch device or the console. */
+static void
+dump_flush (void)
+{
+  size_t i;
+
+  if (out_ofs == 0)
+    return;
+  memset (out_buf + out_ofs, 0, BLOCK_SECTOR_SIZE - out_ofs);
+
+  if (out_block != NULL)
+    block_write (out_block, out_sector++, out_buf);
+  else
+    for (i = 0; i < BLOCK_SECTOR_SIZE; i++)
+      printf ("%s%02x%s", i % 32 == 0 ? IOTRACE_PREFIX : "", out_buf[i],
+              i % 32 == 31 ? "\n" : "");
+  out_ofs = 0;
+}
@@ -0,0 +1,79 @@
+#ifndef DEVICES_IOTRACE_H
+#define DEVICES_IOTRACE_H
+
+/** Block I/O trace.
+
+   When enabled with -iotrace, every request submitted to a block
+   device is recorded in a ring buffer, which is dumped at
+   shutdown to the scratch device or to the console.  The dump is
+   read by utils/iotrace-replay, which also includes this header,
+   so the format below uses only fixed-size types and is laid out
+   without padding.
+
+   A dump is a struct iotrace_header padded to IOTRACE_HEADER_SIZE
+   bytes, followed by REC_CNT struct iotrace_records, oldest
+   first.  On the scratch device it starts at sector 0.  On the
+   console, it is printed in hexadecimal on lines that begin with
+   IOTRACE_PREFIX. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IOTRACE_MAGIC "PINTRACE"
+#define IOTRACE_VERSION 1
+#define IOTRACE_HEADER_SIZE 512
+#define IOTRACE_PREFIX "iotrace: "
+
+/** Most devices described in a dump. */
+#define IOTRACE_DEVS 16
+
+/** A block device, as described in a dump. */
+struct iotrace_device
+  {
+    char name[16];                      /**< Null-terminated name. */
+    uint32_t type;                      /**< enum block_type. */
+    uint32_t size;                      /**< Size in sectors. */
+  };
+
+/** Start of a dump. */
+struct iotrace_header
+  {
+    char magic[8];                      /**< IOTRACE_MAGIC. */
+    uint32_t version;                   /**< IOTRACE_VERSION. */
+    uint32_t rec_cnt;                   /**< Number of records. */
+    uint64_t lost;                      /**< Older records overwritten. */
+    uint32_t cycles_per_us;             /**< Time stamp counter rate. */
+    uint32_t dev_cnt;                   /**< Number of DEVS in use. */
+    struct iotrace_device devs[IOTRACE_DEVS];
+  };
+
+/** Record flags. */
+#define IOTRACE_WRITE 0x01              /**< Write, not read. */
+#define IOTRACE_ROLE_SHIFT 1            /**< enum block_type of the device
+                                           first submitted to, which tells
+                                           the buffer cache (filesys) from
+                                           the VM (swap) and fsutil
+                                           (scratch). */
+#define IOTRACE_ROLE_MASK 0x0e
+
+/** One submitted request. */
+struct iotrace_record
+  {
+    uint32_t time_lo;                   /**< Cycles since the first record, */
+    uint16_t time_hi;                   /**< ...as 48 bits. */
+    uint16_t cnt;                       /**< Number of sectors. */
+    uint32_t sector;                    /**< First sector. */
+    uint16_t tid;                       /**< Submitting thread. */
+    uint8_t dev;                        /**< Index into header's DEVS. */
+    uint8_t flags;                      /**< IOTRACE_* flags. */
+  };
+
+struct block;
+struct block_request;
+
+bool iotrace_configure (const char *dest);
+void iotrace_init (void);
+void iotrace_record (struct block *, const struct block_request *);
+void iotrace_dump (void);
+
+#endif /**< devices/iotrace.h */
@@ -317,8 +317,23 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/** Passes request R for partition P on to the disk that holds P,
+   translating its sector number.  Every request, vectored or not,
+   takes this path, so the disk's driver does the transfer and P
+   needs no readv or writev of its own. */
+static void
+partition_submit (void *p_, struct block_request *r)
+{
+  struct partition *p = p_;
+  r->sector += p->start;
+  block_submit (p->block, r);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    NULL,
+    NULL,
+    partition_submit
   };
@@ -0,0 +1,144 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/io.h"
+
+/** This code reads and writes PCI configuration space through
+   configuration mechanism #1, which every PCI host bridge Pintos
+   runs on (real or emulated) implements.  See [PCI] 3.2.2.3.2. */
+
+/** I/O ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8        /**< Selects a register. */
+#define PCI_CONFIG_DATA 0xcfc           /**< Holds the selected register. */
+
+/** Configuration address fields. */
+#define PCI_ENABLE 0x80000000           /**< Enable configuration cycle. */
+#define PCI_ADDR(BUS, DEV, FUNC) \
+        (((BUS) << 16) | ((DEV) << 11) | ((FUNC) << 8))
+
+/** Header type register and its multi-function bit. */
+#define PCI_REG_HEADER 0x0c
+#define PCI_HEADER_MULTI 0x00800000
+
+static uint32_t
+config_cycle (pci_addr_t addr, uint8_t reg, bool write, uint32_t data)
+{
+  enum intr_level old_level;
+
+  ASSERT (reg % 4 == 0);
+
+  /* The address and data ports form a pair, so don't let an
+     interrupt handler slip in between them. */
+  old_level = intr_disable ();
+  outl (PCI_CONFIG_ADDRESS, PCI_ENABLE | addr | reg);
+  if (write)
+    outl (PCI_CONFIG_DATA, data);
+  else
+    data = inl (PCI_CONFIG_DATA);
+  intr_set_level (old_level);
+  return data;
+}
+
+/** Returns the 32-bit configuration register REG, which must be
+   a multiple of 4, of the PCI function at ADDR. */
+uint32_t
+pci_read_config (pci_addr_t addr, uint8_t reg)
+{
+  return config_cycle (addr, reg, false, 0);
+}
+
+/** Writes DATA to the 32-bit configuration register REG, which
+   must be a multiple of 4, of the PCI function at ADDR. */
+void
+pci_write_config (pci_addr_t addr, uint8_t reg, uint32_t data)
+{
+  config_cycle (addr, reg, true, data);
+}
+
+/** Searches the PCI buses for the functions for which MATCH
+   returns true, given their ID and class registers, and stores
+   the location of the INDEX'th one (counting from 0) into *ADDR.
+   Returns false if there are not that many. */
+static bool
+find_function (bool (*match) (uint32_t id, uint32_t class, uint32_t aux),
+               uint32_t aux, int index, pci_addr_t *addr)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          pci_addr_t a = PCI_ADDR (bus, dev, func);
+          uint32_t id = pci_read_config (a, PCI_REG_ID);
+
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No device here.  If function 0 is missing, so
+                 are the others. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          if (match (id, pci_read_config (a, PCI_REG_CLASS), aux)
+              && index-- == 0)
+            {
+              *addr = a;
+              return true;
+            }
+
+          if (func == 0
+              && !(pci_read_config (a, PCI_REG_HEADER) & PCI_HEADER_MULTI))
+            break;
+        }
+  return false;
+}
+
+static bool
+match_class (uint32_t id UNUSED, uint32_t class, uint32_t class_subclass)
+{
+  return class >> 16 == class_subclass;
+}
+
+static bool
+match_id (uint32_t id, uint32_t class UNUSED, uint32_t device_vendor)
+{
+  return id == device_vendor;
+}
+
+/** Searches the PCI buses for the first function whose class and
+   subclass codes are CLASS and SUBCLASS.  If one is found, stores
+   its location into *ADDR and returns true.  Otherwise, returns
+   false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, pci_addr_t *addr)
+{
+  return find_function (match_class, class << 8 | subclass, 0, addr);
+}
+
+/** Searches the PCI buses for the INDEX'th function, counting
+   from 0, with the given VENDOR and DEVICE IDs.  If there is one,
+   stores its location into *ADDR and returns true.  Otherwise,
+   returns false. */
+bool
+pci_find_id (uint16_t vendor, uint16_t device, int index, pci_addr_t *addr)
+{
+  return find_function (match_id, (uint32_t) device << 16 | vendor,
+                        index, addr);
+}
+
+/** Returns the I/O port base in base address register BAR of the
+   PCI function at ADDR, or 0 if that BAR is not an assigned I/O
+   space region. */
+uint16_t
+pci_io_bar (pci_addr_t addr, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (addr, PCI_REG_BAR0 + bar * 4);
+  if (!(value & 1))
+    return 0;
+  return value & 0xfffc;
+}
@@ -0,0 +1,29 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Location of a PCI function in configuration space, as the
+   bus, device, and function fields of a configuration address. */
+typedef uint32_t pci_addr_t;
+
+/** Standard configuration space registers. */
+#define PCI_REG_ID 0x00         /**< Device ID:Vendor ID. */
+#define PCI_REG_COMMAND 0x04    /**< Status:Command. */
+#define PCI_REG_CLASS 0x08      /**< Class:Subclass:Prog IF:Revision. */
+#define PCI_REG_BAR0 0x10       /**< First base address register. */
+#define PCI_REG_IRQ 0x3c        /**< Interrupt pin and line. */
+
+/** Command register bits. */
+#define PCI_CMD_IO 0x0001       /**< Respond to I/O space accesses. */
+#define PCI_CMD_MEMORY 0x0002   /**< Respond to memory space accesses. */
+#define PCI_CMD_MASTER 0x0004   /**< Allow bus mastering. */
+
+uint32_t pci_read_config (pci_addr_t, uint8_t reg);
+void pci_write_config (pci_addr_t, uint8_t reg, uint32_t);
+bool pci_find_class (uint8_t class, uint8_t subclass, pci_addr_t *);
+bool pci_find_id (uint16_t vendor, uint16_t device, int index, pci_addr_t *);
+uint16_t pci_io_bar (pci_addr_t, int bar);
+
+#endif /**< devices/pci.h */
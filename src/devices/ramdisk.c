@@ -0,0 +1,252 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/** A block device kept entirely in memory.
+
+   Its sectors live in pages allocated one at a time, so that a
+   large RAM disk does not need a contiguous run of free memory.
+   The contents are zero at boot and lost at shutdown.  Requests
+   still pass through the block layer's queue, so the statistics
+   and I/O scheduler apply as they do to a real disk, but each
+   one is served by a memcpy(). */
+
+/** Sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/** Most RAM disks that may be configured. */
+#define RAMDISK_MAX 4
+
+/** A RAM disk. */
+struct ramdisk
+  {
+    uint8_t **pages;                    /**< SIZE / SECTORS_PER_PAGE pages. */
+    block_sector_t size;                /**< Size in sectors. */
+  };
+
+/** RAM disks requested with -ramdisk, created by ramdisk_init(). */
+static struct ramdisk_config
+  {
+    enum block_type role;               /**< Type to register as. */
+    block_sector_t size;                /**< Size in sectors. */
+  }
+configs[RAMDISK_MAX];
+static size_t config_cnt;
+
+static struct block_operations ramdisk_operations;
+
+static bool parse_size (const char *, block_sector_t *);
+static void ramdisk_create (const char *name, enum block_type,
+                            block_sector_t size);
+
+/** Records a RAM disk to create at boot, as described by SPEC in
+   the form ROLE:SIZE, e.g. "filesys:8M".  ROLE is "filesys",
+   "scratch", or "swap".  SIZE is in bytes, with an optional K or
+   M suffix, and is rounded up to a whole page.  Returns false if
+   SPEC is malformed or too many RAM disks were requested.
+
+   Called from option parsing, before memory is set up, so this
+   only takes note of the request. */
+bool
+ramdisk_configure (const char *spec)
+{
+  const char *colon = strchr (spec, ':');
+  enum block_type role;
+
+  if (colon == NULL || config_cnt >= RAMDISK_MAX)
+    return false;
+
+  for (role = BLOCK_FILESYS; role < BLOCK_ROLE_CNT; role++)
+    {
+      const char *name = block_type_name (role);
+      size_t len = strlen (name);
+      if (len == (size_t) (colon - spec) && !memcmp (spec, name, len))
+        break;
+    }
+  if (role == BLOCK_ROLE_CNT
+      || !parse_size (colon + 1, &configs[config_cnt].size))
+    return false;
+
+  configs[config_cnt++].role = role;
+  return true;
+}
+
+/** Creates the RAM disks requested by ramdisk_configure().  They
+   are registered before the disks are probed, so that each one
+   comes first in probe order for its role. */
+void
+ramdisk_init (void)
+{
+  size_t i;
+
+  for (i = 0; i < config_cnt; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "ram%zu", i);
+      ramdisk_create (name, configs[i].role, configs[i].size);
+    }
+}
+
+/** Allocates a RAM disk of SIZE sectors and registers it as NAME
+   with the given TYPE.  Pages come from the user pool, so that
+   the kernel pool is left for the kernel, and at most half of it
+   may be taken, so that user processes still have frames to run
+   in.  If the RAM disk does not fit, prints a message and
+   registers nothing. */
+static void
+ramdisk_create (const char *name, enum block_type type, block_sector_t size)
+{
+  size_t page_cnt = size / SECTORS_PER_PAGE;
+  struct ramdisk *rd;
+  size_t i;
+
+  if (page_cnt > palloc_user_free_cnt () / 2)
+    {
+      printf ("%s: %zu pages do not fit in half of the %zu free user "
+              "pages, not created\n", name, page_cnt, palloc_user_free_cnt ());
+      return;
+    }
+
+  rd = malloc (sizeof *rd);
+  if (rd == NULL)
+    goto nomem;
+  rd->size = size;
+  rd->pages = malloc (page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    {
+      free (rd);
+      goto nomem;
+    }
+  for (i = 0; i < page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO | PAL_USER);
+      if (rd->pages[i] == NULL)
+        {
+          while (i-- > 0)
+            palloc_free_page (rd->pages[i]);
+          free (rd->pages);
+          free (rd);
+          goto nomem;
+        }
+    }
+
+  block_register (name, type, "RAM disk", size, &ramdisk_operations, rd);
+  return;
+
+nomem:
+  printf ("%s: out of memory, not created\n", name);
+}
+
+/** Parses S as a size in bytes with an optional K or M suffix and
+   stores it in *SIZE in sectors, rounded up to a whole page.
+   Returns false if S is not a valid, nonzero size. */
+static bool
+parse_size (const char *s, block_sector_t *size)
+{
+  uint64_t bytes = 0;
+
+  if (*s < '0' || *s > '9')
+    return false;
+  for (; *s >= '0' && *s <= '9'; s++)
+    {
+      bytes = bytes * 10 + (*s - '0');
+      if (bytes > UINT32_MAX)
+        return false;
+    }
+  if (*s == 'K' || *s == 'k')
+    bytes *= 1024, s++;
+  else if (*s == 'M' || *s == 'm')
+    bytes *= 1024 * 1024, s++;
+  if (*s != '\0' || bytes == 0 || bytes > UINT32_MAX)
+    return false;
+
+  bytes = (bytes + PGSIZE - 1) / PGSIZE * PGSIZE;
+  *size = bytes / BLOCK_SECTOR_SIZE;
+  return true;
+}
+
+/** Returns the address of SECTOR in RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  ASSERT (sector < rd->size);
+  return rd->pages[sector / SECTORS_PER_PAGE]
+         + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE;
+}
+
+/** Copies CNT sectors starting at SECTOR of RD to or from BUFFER,
+   page by page. */
+static void
+ramdisk_copy (struct ramdisk *rd, block_sector_t sector, block_sector_t cnt,
+              uint8_t *buffer, bool write)
+{
+  while (cnt > 0)
+    {
+      block_sector_t chunk = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      uint8_t *addr = sector_addr (rd, sector);
+      size_t bytes;
+
+      if (chunk > cnt)
+        chunk = cnt;
+      bytes = chunk * BLOCK_SECTOR_SIZE;
+      if (write)
+        memcpy (addr, buffer, bytes);
+      else
+        memcpy (buffer, addr, bytes);
+      sector += chunk;
+      buffer += bytes;
+      cnt -= chunk;
+    }
+}
+
+/** Reads sector SECTOR from the RAM disk into BUFFER. */
+static void
+ramdisk_read (void *rd_, block_sector_t sector, void *buffer)
+{
+  ramdisk_copy (rd_, sector, 1, buffer, false);
+}
+
+/** Writes sector SECTOR to the RAM disk from BUFFER. */
+static void
+ramdisk_write (void *rd_, block_sector_t sector, const void *buffer)
+{
+  ramdisk_copy (rd_, sector, 1, (uint8_t *) buffer, true);
+}
+
+/** Reads consecutive sectors starting at SECTOR into the IOV_CNT
+   pieces of IOV. */
+static void
+ramdisk_readv (void *rd_, block_sector_t sector,
+               const struct block_iovec *iov, size_t iov_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < iov_cnt; sector += iov[i++].cnt)
+    ramdisk_copy (rd_, sector, iov[i].cnt, iov[i].buffer, false);
+}
+
+/** Writes consecutive sectors starting at SECTOR from the IOV_CNT
+   pieces of IOV. */
+static void
+ramdisk_writev (void *rd_, block_sector_t sector,
+                const struct block_iovec *iov, size_t iov_cnt)
+{
+  size_t i;
+
+  for (i = 0; i < iov_cnt; sector += iov[i++].cnt)
+    ramdisk_copy (rd_, sector, iov[i].cnt, iov[i].buffer, true);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_readv,
+    ramdisk_writev,
+    NULL
+  };
@@ -11,6 +11,8 @@
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "devices/ide.h"
+#include "devices/iotrace.h"
 #include "filesys/filesys.h"
 #endif
 
@@ -92,6 +94,7 @@ shutdown_power_off (void)
 
 #ifdef FILESYS
   filesys_done ();
+  iotrace_dump ();
 #endif
 
   print_stats ();
@@ -132,6 +135,7 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  ide_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
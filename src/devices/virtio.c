@@ -0,0 +1,410 @@
+#include "devices/virtio.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/** The code in this file drives virtio block devices through the
+   legacy PCI interface of [VIRTIO] 0.9.5, which QEMU offers by
+   default ("-drive if=virtio").  Each disk has a single
+   virtqueue.  Several of the block layer's I/O threads put
+   requests on it at once, so that the device always has work
+   queued, and each sleeps until the device's interrupt reports
+   that its own request is done. */
+
+/** PCI IDs of a transitional virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/** Legacy registers, as offsets from the I/O port base in BAR 0. */
+#define REG_DEVICE_FEATURES 0x00        /**< Features offered (r/o). */
+#define REG_GUEST_FEATURES 0x04         /**< Features accepted. */
+#define REG_QUEUE_PFN 0x08              /**< Virtqueue's page number. */
+#define REG_QUEUE_SIZE 0x0c             /**< Virtqueue entries (r/o). */
+#define REG_QUEUE_SELECT 0x0e           /**< Virtqueue to set up. */
+#define REG_QUEUE_NOTIFY 0x10           /**< Virtqueue with new requests. */
+#define REG_STATUS 0x12                 /**< Device status. */
+#define REG_ISR 0x13                    /**< Interrupt status (read clears). */
+#define REG_CAPACITY 0x14               /**< Size in sectors, 64 bits. */
+
+/** Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01         /**< Driver found the device. */
+#define STATUS_DRIVER 0x02              /**< Driver can drive it. */
+#define STATUS_DRIVER_OK 0x04           /**< Driver is ready. */
+#define STATUS_FAILED 0x80              /**< Driver gave up on it. */
+
+/** Feature bits. */
+#define BLK_F_RO 5                      /**< Disk is read-only. */
+
+/** A virtqueue descriptor: one physically contiguous piece of a
+   request. */
+struct vring_desc
+  {
+    uint64_t addr;                      /**< Physical address. */
+    uint32_t len;                       /**< Length in bytes. */
+    uint16_t flags;                     /**< DESC_F_* flags. */
+    uint16_t next;                      /**< Next descriptor in chain. */
+  };
+
+/** Descriptor flags. */
+#define DESC_F_NEXT 0x01                /**< NEXT is valid. */
+#define DESC_F_WRITE 0x02               /**< Device writes the piece. */
+
+/** Ring of requests that the driver has made available to the
+   device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;                       /**< Count of entries made. */
+    uint16_t ring[];                    /**< First descriptor of each. */
+  };
+
+/** Ring of requests that the device has finished. */
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;                       /**< Count of entries made. */
+    struct
+      {
+        uint32_t id;                    /**< First descriptor. */
+        uint32_t len;                   /**< Bytes written. */
+      }
+    ring[];
+  };
+
+/** Header at the start of each request. */
+struct blk_header
+  {
+    uint32_t type;                      /**< BLK_T_IN or BLK_T_OUT. */
+    uint32_t reserved;
+    uint64_t sector;                    /**< First sector. */
+  };
+
+/** Request types. */
+#define BLK_T_IN 0                      /**< Read. */
+#define BLK_T_OUT 1                     /**< Write. */
+
+/** A request in flight. */
+struct blk_req
+  {
+    struct blk_header header;           /**< Read by the device. */
+    uint8_t status;                     /**< Written by the device, 0
+                                           for success. */
+    struct semaphore done;              /**< Up'd on completion. */
+  };
+
+/** A virtio block device. */
+struct virtio_disk
+  {
+    char name[8];                       /**< Name, e.g. "vda". */
+    uint16_t base;                      /**< I/O port base. */
+    uint8_t irq;                        /**< Interrupt vector. */
+
+    uint16_t qsize;                     /**< Entries in the virtqueue. */
+    struct vring_desc *desc;            /**< QSIZE descriptors. */
+    struct vring_avail *avail;          /**< Available ring. */
+    struct vring_used *used;            /**< Used ring. */
+    uint16_t last_used;                 /**< Used entries seen so far. */
+    struct blk_req *reqs;               /**< Indexed by first descriptor. */
+
+    struct lock lock;                   /**< Protects the free descriptors
+                                           and the available ring. */
+    struct condition desc_freed;        /**< Signaled when FREE_CNT grows. */
+    uint16_t free_head;                 /**< First free descriptor. */
+    uint16_t free_cnt;                  /**< Number of free descriptors. */
+  };
+
+/** Most virtio disks supported. */
+#define DISK_CNT 8
+
+/** Number of requests the block layer may have in flight on a
+   disk at once. */
+#define QUEUE_DEPTH 8
+
+static struct virtio_disk *disks[DISK_CNT];
+static size_t disk_cnt;
+
+static struct block_operations virtio_operations;
+
+static void probe_disk (pci_addr_t);
+static bool setup_queue (struct virtio_disk *);
+static void interrupt_handler (struct intr_frame *);
+
+/** Finds and registers the virtio block devices, and scans each
+   for partitions. */
+void
+virtio_init (void)
+{
+  pci_addr_t addr;
+  int i;
+
+  for (i = 0; disk_cnt < DISK_CNT
+              && pci_find_id (VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, i, &addr);
+       i++)
+    probe_disk (addr);
+}
+
+/** Sets up the virtio block device at ADDR and registers it. */
+static void
+probe_disk (pci_addr_t addr)
+{
+  uint16_t base = pci_io_bar (addr, 0);
+  uint8_t irq = pci_read_config (addr, PCI_REG_IRQ) & 0xff;
+  struct virtio_disk *d;
+  uint32_t features;
+  uint64_t capacity;
+  struct block *block;
+  size_t i;
+
+  if (base == 0 || irq >= 16)
+    {
+      printf ("virtio: ignoring disk without I/O ports or interrupt\n");
+      return;
+    }
+  pci_write_config (addr, PCI_REG_COMMAND,
+                    pci_read_config (addr, PCI_REG_COMMAND)
+                    | PCI_CMD_IO | PCI_CMD_MASTER);
+
+  d = malloc (sizeof *d);
+  if (d == NULL)
+    PANIC ("virtio: out of memory");
+  snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+  d->base = base;
+  d->irq = irq + 0x20;
+  lock_init (&d->lock);
+  cond_init (&d->desc_freed);
+
+  /* Reset the device and tell it that we know how to drive it.
+     The only optional feature we accept is being read-only,
+     which the device then enforces itself. */
+  outb (base + REG_STATUS, 0);
+  outb (base + REG_STATUS, STATUS_ACKNOWLEDGE);
+  outb (base + REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  features = inl (base + REG_DEVICE_FEATURES) & (1u << BLK_F_RO);
+  outl (base + REG_GUEST_FEATURES, features);
+  if (!setup_queue (d))
+    {
+      printf ("%s: cannot set up virtqueue\n", d->name);
+      outb (base + REG_STATUS, STATUS_FAILED);
+      free (d);
+      return;
+    }
+
+  capacity = inl (base + REG_CAPACITY)
+             | (uint64_t) inl (base + REG_CAPACITY + 4) << 32;
+  if (capacity > UINT32_MAX)
+    capacity = UINT32_MAX;
+
+  /* Disks may share an interrupt line, so register its handler
+     only once. */
+  for (i = 0; i < disk_cnt; i++)
+    if (disks[i]->irq == d->irq)
+      break;
+  if (i == disk_cnt)
+    intr_register_ext (d->irq, interrupt_handler, "virtio");
+  disks[disk_cnt++] = d;
+  outb (base + REG_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  block = block_register (d->name, BLOCK_RAW,
+                          features ? "virtio, read-only" : "virtio",
+                          capacity, &virtio_operations, d);
+  block_set_queue_depth (block, QUEUE_DEPTH);
+  partition_scan (block);
+}
+
+/** Allocates virtqueue 0 of D, whose size the device dictates,
+   and hands it to the device.  Returns true if successful. */
+static bool
+setup_queue (struct virtio_disk *d)
+{
+  size_t avail_ofs, used_ofs, size;
+  uint8_t *mem;
+  uint16_t i;
+
+  outw (d->base + REG_QUEUE_SELECT, 0);
+  d->qsize = inw (d->base + REG_QUEUE_SIZE);
+  if (d->qsize == 0)
+    return false;
+
+  /* The descriptors and the available ring come first, then the
+     used ring on the next page.  See [VIRTIO] 2.3. */
+  avail_ofs = d->qsize * sizeof *d->desc;
+  used_ofs = ROUND_UP (avail_ofs + sizeof *d->avail
+                       + (d->qsize + 1) * sizeof d->avail->ring[0], PGSIZE);
+  size = used_ofs + sizeof *d->used + d->qsize * sizeof d->used->ring[0]
+         + sizeof (uint16_t);
+  mem = palloc_get_multiple (PAL_ZERO, DIV_ROUND_UP (size, PGSIZE));
+  if (mem == NULL)
+    return false;
+  d->reqs = calloc (d->qsize, sizeof *d->reqs);
+  if (d->reqs == NULL)
+    {
+      palloc_free_multiple (mem, DIV_ROUND_UP (size, PGSIZE));
+      return false;
+    }
+  d->desc = (struct vring_desc *) mem;
+  d->avail = (struct vring_avail *) (mem + avail_ofs);
+  d->used = (struct vring_used *) (mem + used_ofs);
+  d->last_used = 0;
+
+  for (i = 0; i < d->qsize; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = d->qsize;
+
+  outl (d->base + REG_QUEUE_PFN, vtop (mem) / PGSIZE);
+  return true;
+}
+
+/** Reads or writes the sectors starting at SECTOR on disk D from
+   or to the IOV_CNT pieces of IOV, which must be kernel virtual
+   addresses so that each is physically contiguous.  The request
+   goes on the virtqueue alongside any that other threads have in
+   flight, and the calling thread sleeps until it completes. */
+static void
+virtio_transfer (struct virtio_disk *d, block_sector_t sector,
+                 const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  size_t need = iov_cnt + 2, i;
+  struct blk_req *req;
+  uint16_t head, idx;
+  uint8_t status;
+
+  ASSERT (need <= d->qsize);
+
+  lock_acquire (&d->lock);
+  while (d->free_cnt < need)
+    cond_wait (&d->desc_freed, &d->lock);
+
+  /* Chain a descriptor for the header, one for each piece, and
+     one for the status byte.  Only the NEXT members of free
+     descriptors matter, and they already link them. */
+  head = idx = d->free_head;
+  req = &d->reqs[head];
+  req->header.type = write ? BLK_T_OUT : BLK_T_IN;
+  req->header.reserved = 0;
+  req->header.sector = sector;
+  req->status = 0xff;
+  sema_init (&req->done, 0);
+
+  d->desc[idx].addr = vtop (&req->header);
+  d->desc[idx].len = sizeof req->header;
+  d->desc[idx].flags = DESC_F_NEXT;
+  for (i = 0; i < iov_cnt; i++)
+    {
+      idx = d->desc[idx].next;
+      d->desc[idx].addr = vtop (iov[i].buffer);
+      d->desc[idx].len = iov[i].cnt * BLOCK_SECTOR_SIZE;
+      d->desc[idx].flags = DESC_F_NEXT | (write ? 0 : DESC_F_WRITE);
+    }
+  idx = d->desc[idx].next;
+  d->desc[idx].addr = vtop (&req->status);
+  d->desc[idx].len = sizeof req->status;
+  d->desc[idx].flags = DESC_F_WRITE;
+  d->free_head = d->desc[idx].next;
+  d->free_cnt -= need;
+
+  /* Make the request available, then tell the device.  The
+     device must see the ring entry before the index that
+     covers it. */
+  d->avail->ring[d->avail->idx % d->qsize] = head;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (d->base + REG_QUEUE_NOTIFY, 0);
+  lock_release (&d->lock);
+
+  sema_down (&req->done);
+
+  /* Return the chain to the free list. */
+  lock_acquire (&d->lock);
+  status = req->status;
+  for (idx = head, i = 1; i < need; i++)
+    idx = d->desc[idx].next;
+  d->desc[idx].next = d->free_head;
+  d->free_head = head;
+  d->free_cnt += need;
+  cond_broadcast (&d->desc_freed, &d->lock);
+  lock_release (&d->lock);
+
+  if (status != 0)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, write ? "write" : "read", sector);
+}
+
+/** Reads sectors starting at SEC_NO from disk D into the IOV_CNT
+   pieces of IOV. */
+static void
+virtio_readv (void *d, block_sector_t sec_no,
+              const struct block_iovec *iov, size_t iov_cnt)
+{
+  virtio_transfer (d, sec_no, iov, iov_cnt, false);
+}
+
+/** Writes sectors starting at SEC_NO to disk D from the IOV_CNT
+   pieces of IOV. */
+static void
+virtio_writev (void *d, block_sector_t sec_no,
+               const struct block_iovec *iov, size_t iov_cnt)
+{
+  virtio_transfer (d, sec_no, iov, iov_cnt, true);
+}
+
+/** Reads sector SEC_NO from disk D into BUFFER. */
+static void
+virtio_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  struct block_iovec iov = {buffer, 1};
+  virtio_transfer (d, sec_no, &iov, 1, false);
+}
+
+/** Writes sector SEC_NO to disk D from BUFFER. */
+static void
+virtio_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  struct block_iovec iov = {(void *) buffer, 1};
+  virtio_transfer (d, sec_no, &iov, 1, true);
+}
+
+static struct block_operations virtio_operations =
+  {
+    virtio_read,
+    virtio_write,
+    virtio_readv,
+    virtio_writev,
+    NULL
+  };
+
+/** Virtio interrupt handler.  Wakes the thread waiting for each
+   request that a disk on this interrupt line has finished. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *d = disks[i];
+      if (d->irq != f->vec_no)
+        continue;
+
+      /* Reading the status acknowledges the interrupt. */
+      inb (d->base + REG_ISR);
+      while (d->last_used != *(volatile uint16_t *) &d->used->idx)
+        {
+          barrier ();
+          sema_up (&d->reqs[d->used->ring[d->last_used % d->qsize].id].done);
+          d->last_used++;
+        }
+    }
+}
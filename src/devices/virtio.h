@@ -0,0 +1,6 @@
+#ifndef DEVICES_VIRTIO_H
+#define DEVICES_VIRTIO_H
+
+void virtio_init (void);
+
+#endif /**< devices/virtio.h */
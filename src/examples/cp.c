@@ -16,6 +16,10 @@ main (int argc, char *argv[])
       return EXIT_FAILURE;
     }
 
+  /* Share the blocks of the input file if the file system can. */
+  if (clone (argv[1], argv[2]))
+    return EXIT_SUCCESS;
+
   /* Open input file. */
   in_fd = open (argv[1]);
   if (in_fd < 0) 
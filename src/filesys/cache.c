@@ -7,6 +7,7 @@
 #include "threads/synch.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 
 /* Filesys Cache Entry */
 struct FCE {
@@ -16,6 +17,15 @@ struct FCE {
     bool available;                     /**< True if this slot is empty */
     bool dirty;                         /**< True if dirty */
     bool accessed;                      /**< True if accessed recently */
+    block_sector_t owner;               /**< Inode sector of last writer */
+    bool pinned;                        /**< True if not yet journaled */
+    unsigned pin_seq;                   /**< Transaction that pinned it */
+    bool logged;                        /**< True if home is older than
+                                             the copy at log_sector */
+    block_sector_t log_sector;          /**< Last journaled copy */
+    bool pending;                       /**< True while REQ is reading
+                                             the slot in ahead */
+    struct block_request req;           /**< Disk request in flight */
     struct lock lock;                   /**< Lock for synchronization */
 };
 
@@ -25,12 +35,18 @@ static struct FCE* filesys_load_cache (block_sector_t);
 static struct FCE* filesys_get_cache (void);
 static void filesys_cache_flush (struct FCE*);
 static struct FCE* filesys_find_fce (block_sector_t);
+static void filesys_cache_read_ahead (block_sector_t);
+static void filesys_cache_start_write (struct FCE*);
+static void filesys_cache_end_write (struct FCE*);
 
 void filesys_cache_init (void)
 {
     for (int i=0;i<CACHE_SIZE;i++)
     {
         fct[i].available = true;
+        fct[i].pinned = false;
+        fct[i].logged = false;
+        fct[i].pending = false;
         lock_init (&fct[i].lock);
     }
 }
@@ -45,33 +61,180 @@ filesys_cache_read (block_sector_t id, void *buffer, size_t ofs, size_t size)
     memcpy (buffer, fce->cache + ofs, size);
     lock_release (&fce->lock);
     if (id < block_size (fs_device) - 1)
-    {
-        fce = filesys_load_cache (id + 1);
-        lock_release (&fce->lock);
-    }
+        filesys_cache_read_ahead (id + 1);
 }
 
 /**
  * Write to sector ID from BUFFER with cache enabled.
+ * OWNER is the sector of the inode the block belongs to.
  */
 void 
 filesys_cache_write (block_sector_t id, const void *buffer, 
-                     size_t ofs, size_t size)
+                     size_t ofs, size_t size, block_sector_t owner)
 {
     struct FCE *fce = filesys_load_cache (id);
     memcpy (fce->cache + ofs, buffer, size);
     fce->dirty = true;
+    fce->owner = owner;
+    lock_release (&fce->lock);
+}
+
+/**
+ * Write metadata to sector ID from BUFFER with cache enabled.
+ * The slot is pinned in the cache until the journal transaction
+ * it joins has been committed, so that it never reaches its home
+ * location before its log record does.
+ */
+void 
+filesys_cache_write_meta (block_sector_t id, const void *buffer, 
+                          size_t ofs, size_t size, block_sector_t owner)
+{
+    struct FCE *fce = filesys_load_cache (id);
+    memcpy (fce->cache + ofs, buffer, size);
+    fce->dirty = true;
+    fce->owner = owner;
+    fce->pinned = true;
+    fce->pin_seq = journal_add (id);
+    lock_release (&fce->lock);
+}
+
+/**
+ * Copy the cached content of the pinned sector ID into BUFFER.
+ */
+void
+filesys_cache_snapshot (block_sector_t id, void *buffer)
+{
+    struct FCE *fce = filesys_find_fce (id);
+    ASSERT (fce != NULL && fce->pinned);
+    memcpy (buffer, fce->cache, BLOCK_SECTOR_SIZE);
+    lock_release (&fce->lock);
+}
+
+/**
+ * Unpin sector ID after journal transaction SEQ, which logged it
+ * at LOG_SECTOR, has committed, unless a later transaction has
+ * modified it again.
+ */
+void
+filesys_cache_unpin (block_sector_t id, unsigned seq, 
+                     block_sector_t log_sector)
+{
+    struct FCE *fce = filesys_find_fce (id);
+    ASSERT (fce != NULL && fce->pinned);
+    fce->logged = true;
+    fce->log_sector = log_sector;
+    if (fce->pin_seq == seq)
+        fce->pinned = false;
     lock_release (&fce->lock);
 }
 
+/**
+ * Bring the home location of every committed sector up to date,
+ * so that the journal may discard its log.  Unpinned dirty slots
+ * are written back in place, all submitted at once so that the
+ * disk can sort them.  Pinned slots hold changes not yet
+ * committed, so their last logged copy is written home instead.
+ */
+void
+filesys_cache_checkpoint (void)
+{
+    static uint8_t copy[BLOCK_SECTOR_SIZE];
+    struct FCE *writing[CACHE_SIZE];
+    int cnt = 0;
+    for (int i=0;i<CACHE_SIZE;i++)
+    {
+        struct FCE *fce = fct + i;
+        lock_acquire (&fce->lock);
+        if (!fce->available && fce->dirty && !fce->pinned)
+        {
+            filesys_cache_start_write (fce);
+            writing[cnt++] = fce;
+            continue;
+        }
+        else if (!fce->available && fce->pinned && fce->logged)
+        {
+            block_read (fs_device, fce->log_sector, copy);
+            block_write (fs_device, fce->sector_id, copy);
+            fce->logged = false;
+        }
+        lock_release (&fce->lock);
+    }
+    for (int i=0;i<cnt;i++)
+    {
+        filesys_cache_end_write (writing[i]);
+        lock_release (&writing[i]->lock);
+    }
+}
+
+/**
+ * Write back the dirty slots of the inode at sector OWNER.
+ * Pinned slots must reach the journal first and are left alone.
+ * Returns true if any of them was pinned.
+ */
+bool
+filesys_cache_sync (block_sector_t owner)
+{
+    bool pinned = false;
+    struct FCE *writing[CACHE_SIZE];
+    int cnt = 0;
+    for (int i=0;i<CACHE_SIZE;i++)
+    {
+        struct FCE *fce = fct + i;
+        lock_acquire (&fce->lock);
+        if (!fce->available && fce->owner == owner)
+        {
+            if (fce->pinned)
+                pinned = true;
+            else if (fce->dirty)
+            {
+                filesys_cache_start_write (fce);
+                writing[cnt++] = fce;
+                continue;
+            }
+        }
+        lock_release (&fce->lock);
+    }
+    for (int i=0;i<cnt;i++)
+    {
+        filesys_cache_end_write (writing[i]);
+        lock_release (&writing[i]->lock);
+    }
+    return pinned;
+}
+
 /**
  * Close the cache by flushing all the slots. 
+ * The writes are submitted together and then waited for.
  */
 void filesys_cache_close ()
 {
+    struct FCE *writing[CACHE_SIZE];
+    int cnt = 0;
     for (int i=0;i<CACHE_SIZE;i++)
-        if (!fct[i].available)
-            filesys_cache_flush (fct+i);
+    {
+        struct FCE *fce = fct + i;
+        if (fce->available)
+            continue;
+        lock_acquire (&fce->lock);
+        if (fce->pending)
+        {
+            block_wait (&fce->req);
+            fce->pending = false;
+        }
+        fce->available = true;
+        if (fce->dirty)
+        {
+            filesys_cache_start_write (fce);
+            writing[cnt++] = fce;
+            continue;
+        }
+        lock_release (&fce->lock);
+    }
+    for (int i=0;i<cnt;i++)
+    {
+        filesys_cache_end_write (writing[i]);
+        lock_release (&writing[i]->lock);
+    }
 }
 
 /**
@@ -90,21 +253,84 @@ static struct FCE* filesys_load_cache (block_sector_t id)
         fce->sector_id = id;
         fce->available = false;
         fce->dirty = false;
+        fce->pinned = false;
+        fce->logged = false;
+        fce->owner = CACHE_NO_OWNER;
+    }
+    else if (fce->pending)
+    {
+        block_wait (&fce->req);
+        fce->pending = false;
     }
     fce->accessed = true;
     return fce;
 }
 
+/**
+ * Start reading sector ID into the cache, if it is not there
+ * already, without waiting for the disk.  The slot is marked
+ * pending until whoever uses it first waits for the read.
+ */
+static void filesys_cache_read_ahead (block_sector_t id)
+{
+    struct FCE* fce = filesys_find_fce (id);
+    if (fce == NULL)
+    {
+        fce = filesys_get_cache ();
+        ASSERT (fce != NULL && fce->available);
+
+        fce->sector_id = id;
+        fce->available = false;
+        fce->dirty = false;
+        fce->pinned = false;
+        fce->logged = false;
+        fce->owner = CACHE_NO_OWNER;
+        fce->accessed = true;
+        fce->pending = true;
+        block_request_init (&fce->req, false, id, 1, fce->cache, NULL, NULL);
+        block_submit (fs_device, &fce->req);
+    }
+    lock_release (&fce->lock);
+}
+
+/**
+ * Submit a write of dirty slot FCE to disk without waiting.
+ * FCE stays locked until filesys_cache_end_write().
+ */
+static void filesys_cache_start_write (struct FCE *fce)
+{
+    block_request_init (&fce->req, true, fce->sector_id, 1, fce->cache,
+                        NULL, NULL);
+    block_submit (fs_device, &fce->req);
+}
+
+/**
+ * Wait for the write started on FCE and mark it clean.
+ */
+static void filesys_cache_end_write (struct FCE *fce)
+{
+    block_wait (&fce->req);
+    fce->dirty = false;
+    fce->logged = false;
+}
+
 /**
  * Get an available cache slot. 
+ * Pinned slots are skipped.  journal_begin() keeps the running
+ * transaction from pinning every slot.
  */
 static struct FCE* filesys_get_cache (void)
 {
     static int clock = 0;
+    int scanned = 0;
     while (true)
     {
+        if (scanned++ == 2 * CACHE_SIZE)
+            PANIC ("filesys_get_cache: every slot holds uncommitted "
+                   "metadata");
         lock_acquire (&fct[clock].lock);
-        if (fct[clock].available || !fct[clock].accessed)
+        if (fct[clock].available 
+            || (!fct[clock].accessed && !fct[clock].pinned))
             break;
         fct[clock].accessed = false;
         lock_release (&fct[clock].lock);
@@ -121,7 +347,13 @@ static struct FCE* filesys_get_cache (void)
 static void filesys_cache_flush (struct FCE *fce)
 {
     ASSERT (fce != NULL && !fce->available);
+    if (fce->pending)
+    {
+        block_wait (&fce->req);
+        fce->pending = false;
+    }
     fce->available = true;
+    fce->logged = false;
     if (fce->dirty)
     {
         block_write (fs_device, fce->sector_id, fce->cache);
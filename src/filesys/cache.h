@@ -1,12 +1,21 @@
 #ifndef __FILESYS_CACHE_H
 #define __FILESYS_CACHE_H
+#include <stdbool.h>
 #include <devices/block.h>
 
 #define CACHE_SIZE 64
+#define CACHE_NO_OWNER ((block_sector_t) -1)
 
 void filesys_cache_init (void);
 void filesys_cache_read (block_sector_t, void*, size_t, size_t);
-void filesys_cache_write (block_sector_t, const void*, size_t, size_t);
+void filesys_cache_write (block_sector_t, const void*, size_t, size_t,
+                          block_sector_t);
+void filesys_cache_write_meta (block_sector_t, const void*, size_t, size_t,
+                               block_sector_t);
+void filesys_cache_snapshot (block_sector_t, void*);
+void filesys_cache_unpin (block_sector_t, unsigned, block_sector_t);
+void filesys_cache_checkpoint (void);
+bool filesys_cache_sync (block_sector_t);
 void filesys_cache_close (void);
 
 #endif
\ No newline at end of file
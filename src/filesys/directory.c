@@ -23,7 +23,23 @@ struct dir_entry
     bool in_use;                        /**< In use or free? */
   };
 
+/** Compact a directory once it holds this many deleted entries. */
+#define DIR_COMPACT_CNT 32
+
 static bool dir_add_parent (struct dir*, struct dir*);
+static void dir_reclaim (struct dir *, off_t);
+static void dir_compact (struct dir *);
+
+/** Returns true if E has never been used.  Slots are handed out
+   in increasing order and a directory only grows at its end, so
+   the first such slot marks the end of the used part of the
+   directory and every slot after it is unused too.  Deleted
+   entries keep their inode sector, which is never 0. */
+static inline bool
+is_end_entry (const struct dir_entry *e)
+{
+  return !e->in_use && e->inode_sector == 0;
+}
 
 /** Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. 
@@ -127,18 +143,22 @@ dir_get_inode (const struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   A failed search has seen every used slot, so it also refreshes
+   the count of deleted entries in DIR's hint. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
   size_t ofs;
+  int free_cnt = 0;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  /* Slot 0 holds the parent entry, which has no name. */
+  for (ofs = sizeof e; inode_read_at (dir->inode,&e,sizeof e,ofs)==sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
       {
@@ -148,6 +168,11 @@ lookup (const struct dir *dir, const char *name,
           *ofsp = ofs;
         return true;
       }
+    else if (is_end_entry (&e))
+      break;
+    else if (!e.in_use)
+      free_cnt++;
+  inode_dir_hint (dir->inode)->free_cnt = free_cnt;
   return false;
 }
 
@@ -190,13 +215,14 @@ dir_add (struct dir *dir, const char *name,
          block_sector_t inode_sector, bool is_dir)
 {
   struct dir_entry e;
+  struct dir_hint *hint;
   off_t ofs;
+  bool reused = false;
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-
   /* Check NAME for validity. */
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
@@ -220,23 +246,35 @@ dir_add (struct dir *dir, const char *name,
     if (!flag) goto done;
   }
 
-  /* Set OFS to offset of free slot.
+  /* Set OFS to offset of free slot, starting from the hint since
+     every slot below it is in use.
      If there are no free slots, then it will be set to the
      current end-of-file.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = sizeof e; inode_read_at (dir->inode,&e,sizeof e,ofs)==sizeof e;
+  hint = inode_dir_hint (dir->inode);
+  ofs = hint->free_ofs > (off_t) sizeof e ? hint->free_ofs : (off_t) sizeof e;
+  for (; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (!e.in_use)
-      break;
+      {
+        reused = !is_end_entry (&e);
+        break;
+      }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    {
+      hint->free_ofs = ofs + sizeof e;
+      if (reused && hint->free_cnt > 0)
+        hint->free_cnt--;
+    }
 
  done:
   inode_lock_release (dir_get_inode (dir));
@@ -284,6 +322,7 @@ dir_remove (struct dir *dir, const char *name)
   /* Remove inode. */
   inode_remove (inode);
   success = true;
+  dir_reclaim (dir, ofs);
 
  done:
   inode_close (inode);
@@ -300,7 +339,8 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
   struct dir_entry e;
 
   inode_lock_acquire (dir_get_inode (dir));
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e
+         && !is_end_entry (&e)) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
@@ -339,7 +379,8 @@ bool dir_is_empty (const struct dir *dir)
 {
   struct dir_entry e;
   for (off_t ofs = sizeof e; 
-       inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e; 
+       inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+       && !is_end_entry (&e); 
        ofs += sizeof e) 
     if (e.in_use)
       return false;
@@ -363,4 +404,72 @@ static bool dir_add_parent (struct dir *dir, struct dir *parent)
   e.in_use = true;
   e.inode_sector = inode_get_inumber(parent->inode);
   return inode_write_at (dir->inode, &e, sizeof e, 0) == sizeof e;
-}
\ No newline at end of file
+}
+
+/**
+ * Reclaim slots after the entry at OFS in DIR has been deleted.
+ * Deleted entries at the end of the used slots are turned back
+ * into unused ones, so lookups stop before them.  If many deleted
+ * entries remain, the directory is compacted.
+ */
+static void dir_reclaim (struct dir *dir, off_t ofs)
+{
+  struct dir_entry e;
+  struct dir_hint *hint = inode_dir_hint (dir->inode);
+
+  if (ofs < hint->free_ofs)
+    hint->free_ofs = ofs;
+  if (hint->free_cnt >= 0)
+    hint->free_cnt++;
+
+  /* Trim deleted entries off the end of the used slots. */
+  if (inode_read_at (dir->inode, &e, sizeof e, ofs + sizeof e) != sizeof e
+      || is_end_entry (&e))
+    {
+      memset (&e, 0, sizeof e);
+      for (; ofs >= (off_t) sizeof e; ofs -= sizeof e)
+        {
+          struct dir_entry prev;
+          if (inode_read_at (dir->inode, &prev, sizeof prev, ofs) != sizeof prev
+              || prev.in_use
+              || inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            break;
+          if (hint->free_cnt > 0)
+            hint->free_cnt--;
+        }
+    }
+
+  /* Moving entries would disturb the readdir() position of other
+     openers, so only compact a directory nobody else has open. */
+  if (hint->free_cnt >= DIR_COMPACT_CNT && inode_open_cnt (dir->inode) == 1)
+    dir_compact (dir);
+}
+
+/**
+ * Slide the entries in use in DIR down over the deleted ones and
+ * mark the vacated slots at the end as unused.
+ */
+static void dir_compact (struct dir *dir)
+{
+  struct dir_entry e;
+  struct dir_hint *hint = inode_dir_hint (dir->inode);
+  off_t src, dst = sizeof e;
+
+  for (src = sizeof e; 
+       inode_read_at (dir->inode, &e, sizeof e, src) == sizeof e
+       && !is_end_entry (&e); 
+       src += sizeof e)
+    if (e.in_use)
+      {
+        if (src != dst 
+            && inode_write_at (dir->inode, &e, sizeof e, dst) != sizeof e)
+          return;
+        dst += sizeof e;
+      }
+
+  hint->free_ofs = dst;
+  hint->free_cnt = 0;
+  memset (&e, 0, sizeof e);
+  for (; dst < src; dst += sizeof e)
+    inode_write_at (dir->inode, &e, sizeof e, dst);
+}
@@ -8,12 +8,14 @@
 #include "filesys/directory.h"
 #include "filesys/cache.h"
 #include "filesys/fsutil.h"
+#include "filesys/journal.h"
 
 
 /** Partition that contains the file system. */
 struct block *fs_device;
 
 static void do_format (void);
+static bool do_create (const char *, off_t, bool, bool);
 
 /** Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -27,6 +29,7 @@ filesys_init (bool format)
 
   inode_init ();
   free_map_init ();
+  journal_init (format);
 
   if (format) 
     do_format ();
@@ -34,12 +37,27 @@ filesys_init (bool format)
   free_map_open ();
 }
 
+/** Whether filesys_done() writes back the file system. */
+static bool sync_at_shutdown = true;
+
+/** Sets whether filesys_done() writes unwritten data to disk.
+   Turning it off makes power-off behave like a crash, so tests
+   can check that fsync alone made their data durable. */
+void
+filesys_set_sync_at_shutdown (bool sync)
+{
+  sync_at_shutdown = sync;
+}
+
 /** Shuts down the file system module, writing any unwritten data
    to disk. */
 void
 filesys_done (void) 
 {
+  if (!sync_at_shutdown)
+    return;
   free_map_close ();
+  journal_done ();
   filesys_cache_close ();
 }
 
@@ -49,19 +67,42 @@ filesys_done (void)
    or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size, bool is_dir) 
+{
+  return do_create (name, initial_size, is_dir, false);
+}
+
+/** Creates a compressed file named NAME with the given INITIAL_SIZE.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_create_compressed (const char *name, off_t initial_size)
+{
+  return do_create (name, initial_size, false, true);
+}
+
+/** Creates a file or directory for filesys_create() and
+   filesys_create_compressed(). */
+static bool
+do_create (const char *name, off_t initial_size, bool is_dir,
+           bool compressed)
 {
   block_sector_t inode_sector = 0;
   size_t len = strlen (name);
   char directory[len+1], filename[len+1];
   fsutil_parse_path (name, directory, filename);
+  journal_begin ();
   struct dir *dir = dir_open_path (directory);
   bool success = (dir != NULL
                   && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size, is_dir)
+                  && (compressed
+                      ? inode_create_compressed (inode_sector, initial_size)
+                      : inode_create (inode_sector, initial_size, is_dir))
                   && dir_add (dir, filename, inode_sector, is_dir));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -105,21 +146,71 @@ filesys_remove (const char *name)
   size_t len = strlen(name);
   char directory [len + 1], filename [len + 1];
   fsutil_parse_path (name, directory, filename);
+  journal_begin ();
   struct dir *dir = dir_open_path (directory);
   bool success = dir != NULL && dir_remove (dir, filename);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
 
+/** Creates a file named DST that is a copy-on-write clone of the
+   regular file named SRC, sharing its data blocks.
+   Returns true if successful, false otherwise.
+   Fails if SRC does not exist or is a directory, if a file named
+   DST already exists, or if disk or memory allocation fails. */
+bool
+filesys_clone (const char *src, const char *dst)
+{
+  block_sector_t inode_sector = 0;
+  size_t len = strlen (dst);
+  char directory[len+1], filename[len+1];
+  fsutil_parse_path (dst, directory, filename);
+
+  struct file *file = filesys_open (src);
+  if (file == NULL)
+    return false;
+  struct inode *src_inode = file_get_inode (file);
+
+  /* The clone is added empty and grows as its block map is
+     copied, so that a crash part-way leaves a shorter clone rather
+     than a lost one. */
+  journal_begin ();
+  struct dir *dir = dir_open_path (directory);
+  bool success = (dir != NULL && !inode_is_dir (src_inode)
+                  && free_map_allocate (1, &inode_sector)
+                  && inode_create (inode_sector, 0, false)
+                  && dir_add (dir, filename, inode_sector, false));
+  if (!success && inode_sector != 0)
+    free_map_release (inode_sector, 1);
+  if (success)
+    {
+      struct inode *inode = inode_open (inode_sector);
+      success = inode != NULL && inode_clone (src_inode, inode);
+      /* Drop a failed clone along with its block references. */
+      if (!success)
+        dir_remove (dir, filename);
+      inode_close (inode);
+    }
+  dir_close (dir);
+  journal_end ();
+  file_close (file);
+
+  return success;
+}
+
 /** Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  journal_begin ();
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
+  journal_end ();
+  journal_commit ();
   printf ("done.\n");
 }
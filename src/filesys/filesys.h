@@ -7,14 +7,19 @@
 /** Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /**< Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /**< Root directory file inode sector. */
+#define REF_MAP_SECTOR 2        /**< Reference count file inode sector. */
+#define JOURNAL_SECTOR 3        /**< Journal header sector. */
 
 /** Block device that contains the file system. */
 struct block *fs_device;
 
 void filesys_init (bool format);
 void filesys_done (void);
+void filesys_set_sync_at_shutdown (bool);
 bool filesys_create (const char *name, off_t initial_size, bool);
+bool filesys_create_compressed (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+bool filesys_clone (const char *src, const char *dst);
 
 #endif /**< filesys/filesys.h */
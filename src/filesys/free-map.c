@@ -1,13 +1,24 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <stdint.h>
+#include "threads/malloc.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 
 static struct file *free_map_file;   /**< Free map file. */
 static struct bitmap *free_map;      /**< Free map, one bit per sector. */
 
+/** Sectors shared by cloned files carry extra references, counted
+   one byte per sector in the reference map.  A sector is only
+   returned to the free map once its last reference is released. */
+static struct file *ref_map_file;   /**< Reference map file. */
+static uint8_t *ref_map;            /**< Extra references per sector. */
+
+static void ref_map_write (block_sector_t);
+
 /** Initializes the free map. */
 void
 free_map_init (void) 
@@ -17,6 +28,11 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, REF_MAP_SECTOR);
+  ref_map = calloc (block_size (fs_device), 1);
+  if (ref_map == NULL)
+    PANIC ("reference map creation failed");
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, journal_sectors (), true);
 }
 
 /** Allocates CNT consecutive sectors from the free map and stores
@@ -40,13 +56,89 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
   return sector != BITMAP_ERROR;
 }
 
-/** Makes CNT sectors starting at SECTOR available for use. */
+/** Finds CNT consecutive free sectors without allocating them and
+   stores the first into *SECTORP.  Returns true if successful,
+   false if not enough consecutive sectors are free. */
+bool
+free_map_find (size_t cnt, block_sector_t *sectorp)
+{
+  block_sector_t sector = bitmap_scan (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
+    *sectorp = sector;
+  return sector != BITMAP_ERROR;
+}
+
+/** Allocates the CNT sectors starting at SECTOR.
+   Returns true if successful, false if any of them is already in
+   use or if the free_map file could not be written. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  if (!bitmap_none (free_map, sector, cnt))
+    return false;
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  if (free_map_file != NULL && !bitmap_write (free_map, free_map_file))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, false);
+      return false;
+    }
+  return true;
+}
+
+/** Drops a reference to each of the CNT sectors starting at
+   SECTOR, and makes those with no reference left available for
+   use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  bool freed = false;
+  size_t i;
+
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  for (i = 0; i < cnt; i++)
+    if (ref_map[sector + i] > 0)
+      {
+        ref_map[sector + i]--;
+        ref_map_write (sector + i);
+      }
+    else
+      {
+        journal_revoke (sector + i);
+        bitmap_reset (free_map, sector + i);
+        freed = true;
+      }
+  if (freed)
+    bitmap_write (free_map, free_map_file);
+}
+
+/** Adds a reference to allocated SECTOR, which is about to be
+   shared by another file.  Returns false if SECTOR already has
+   as many references as can be counted. */
+bool
+free_map_share (block_sector_t sector)
+{
+  ASSERT (bitmap_test (free_map, sector));
+  if (ref_map[sector] == UINT8_MAX)
+    return false;
+  ref_map[sector]++;
+  ref_map_write (sector);
+  return true;
+}
+
+/** Returns true if SECTOR is used by more than one file. */
+bool
+free_map_is_shared (block_sector_t sector)
+{
+  return ref_map[sector] > 0;
+}
+
+/** Writes the reference count of SECTOR to disk. */
+static void
+ref_map_write (block_sector_t sector)
+{
+  if (ref_map_file != NULL
+      && file_write_at (ref_map_file, ref_map + sector, 1, sector) != 1)
+    PANIC ("can't write reference map");
 }
 
 /** Opens the free map file and reads it from disk. */
@@ -58,6 +150,13 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+
+  off_t size = block_size (fs_device);
+  ref_map_file = file_open (inode_open (REF_MAP_SECTOR));
+  if (ref_map_file == NULL)
+    PANIC ("can't open reference map");
+  if (file_read_at (ref_map_file, ref_map, size, 0) != size)
+    PANIC ("can't read reference map");
 }
 
 /** Writes the free map to disk and closes the free map file. */
@@ -65,6 +164,8 @@ void
 free_map_close (void) 
 {
   file_close (free_map_file);
+  file_close (ref_map_file);
+  free_map_file = ref_map_file = NULL;
 }
 
 /** Creates a new free map file on disk and writes the free map to
@@ -82,4 +183,8 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+
+  /* Create the reference map, which starts out all zeros. */
+  if (!inode_create (REF_MAP_SECTOR, block_size (fs_device), false))
+    PANIC ("reference map creation failed");
 }
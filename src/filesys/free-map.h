@@ -12,6 +12,10 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_find (size_t, block_sector_t *);
+bool free_map_allocate_at (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
+bool free_map_share (block_sector_t);
+bool free_map_is_shared (block_sector_t);
 
 #endif /**< filesys/free-map.h */
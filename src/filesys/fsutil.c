@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +8,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -67,6 +69,105 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/** Clones file ARGV[1] into new file ARGV[2]. */
+void
+fsutil_clone (char **argv) 
+{
+  const char *src = argv[1];
+  const char *dst = argv[2];
+  
+  printf ("Cloning '%s' to '%s'...\n", src, dst);
+  if (!filesys_clone (src, dst))
+    PANIC ("%s: clone failed\n", dst);
+}
+
+/** Prints the fragmentation of regular file INODE, named PATH, and
+   moves it into contiguous sectors if it is fragmented.  The
+   score is the percentage of consecutive block pairs that are not
+   adjacent on disk: 0 for a contiguous file, 100 when no two
+   blocks are.  Returns true if the file was moved. */
+static bool
+defrag_file (struct inode *inode, const char *path)
+{
+  size_t sectors, extents;
+  bool moved = false;
+
+  inode_frag_stats (inode, &sectors, &extents);
+  printf ("%s: %zu sectors in %zu extents, score %zu",
+          path, sectors, extents,
+          sectors > 1 ? (extents - 1) * 100 / (sectors - 1) : 0);
+  if (extents > 1)
+    {
+      moved = inode_defrag (inode);
+      printf (moved ? ", moved" : ", skipped");
+    }
+  printf ("\n");
+  return moved;
+}
+
+/** Defragments the files in DIR, named PATH, and its
+   subdirectories.  Returns the number of files moved. */
+static int
+defrag_dir (struct dir *dir, const char *path)
+{
+  char name[NAME_MAX + 1];
+  int moved = 0;
+
+  while (dir_readdir (dir, name))
+    {
+      struct inode *inode;
+      char sub_path[strlen (path) + strlen (name) + 2];
+
+      if (!dir_lookup (dir, name, &inode))
+        continue;
+      snprintf (sub_path, sizeof sub_path, "%s/%s", path, name);
+      if (inode_is_dir (inode))
+        {
+          struct dir *sub_dir = dir_open (inode);
+          if (sub_dir != NULL)
+            {
+              moved += defrag_dir (sub_dir, sub_path);
+              dir_close (sub_dir);
+            }
+        }
+      else
+        {
+          moved += defrag_file (inode, sub_path);
+          inode_close (inode);
+        }
+    }
+  return moved;
+}
+
+/** Moves every fragmented file into contiguous sectors, reporting
+   the fragmentation of each file. */
+void
+fsutil_defrag (char **argv UNUSED) 
+{
+  struct dir *dir;
+  int moved;
+
+  printf ("Defragmenting file system...\n");
+  dir = dir_open_root ();
+  if (dir == NULL)
+    PANIC ("root dir open failed");
+  moved = defrag_dir (dir, "");
+  dir_close (dir);
+  printf ("Defragmentation done, %d file(s) moved.\n", moved);
+}
+
+/** Prints detailed I/O statistics for the block devices. */
+void
+fsutil_iostat (char **argv UNUSED)
+{
+  block_print_iostats ();
+}
+
+/** Pages of file data fsutil_extract() reads from the scratch
+   device at a time. */
+#define EXTRACT_PAGES 4
+#define EXTRACT_SECTORS (EXTRACT_PAGES * PGSIZE / BLOCK_SECTOR_SIZE)
+
 /** Extracts a ustar-format tar archive from the scratch block
    device into the Pintos file system. */
 void
@@ -79,7 +180,7 @@ fsutil_extract (char **argv UNUSED)
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = palloc_get_multiple (0, EXTRACT_PAGES);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -124,13 +225,20 @@ fsutil_extract (char **argv UNUSED)
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
 
-          /* Do copy. */
+          /* Do copy, up to EXTRACT_SECTORS sectors per request. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
+              block_sector_t chunk_sectors = DIV_ROUND_UP (size,
+                                                           BLOCK_SECTOR_SIZE);
+              int chunk_size;
+
+              if (chunk_sectors > EXTRACT_SECTORS)
+                chunk_sectors = EXTRACT_SECTORS;
+              chunk_size = (size > (int) (chunk_sectors * BLOCK_SECTOR_SIZE)
+                            ? (int) (chunk_sectors * BLOCK_SECTOR_SIZE)
+                            : size);
+              block_read_multiple (src, sector, chunk_sectors, data);
+              sector += chunk_sectors;
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -151,7 +259,7 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
+  palloc_free_multiple (data, EXTRACT_PAGES);
   free (header);
 }
 
@@ -4,6 +4,9 @@
 void fsutil_ls (char **argv);
 void fsutil_cat (char **argv);
 void fsutil_rm (char **argv);
+void fsutil_clone (char **argv);
+void fsutil_defrag (char **argv);
+void fsutil_iostat (char **argv);
 void fsutil_extract (char **argv);
 void fsutil_append (char **argv);
 void fsutil_parse_path (const char *, char *, char *);
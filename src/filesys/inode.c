@@ -8,12 +8,25 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/cache.h"
+#include "filesys/journal.h"
+#include "filesys/lz.h"
 
 /** Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 #define DIRECT_BLOCK_NUM 124
 #define INDIRECT_BLOCK_NUM (BLOCK_SECTOR_SIZE/4)
 #define MIN(x, y) ((x)<(y)?(x):(y))
+#define DEFRAG_BATCH 32         /**< Sectors moved per transaction. */
+#define CLUSTER_SIZE 4096       /**< Compression unit in bytes. */
+#define CLUSTER_SECTORS (CLUSTER_SIZE / BLOCK_SECTOR_SIZE)
+/** Most bytes a regular file grows by in one journal transaction. */
+#define EXTEND_CHUNK (64 * BLOCK_SECTOR_SIZE)
+/** Block map entries cloned in one journal transaction.  Few enough
+   that a fragmented file, whose blocks each need a reference map
+   sector of their own, still fits, and whole clusters. */
+#define CLONE_CHUNK (2 * CLUSTER_SECTORS)
+/** Compressed clusters stored in one journal transaction. */
+#define COMPRESS_CHUNK 8
 
 
 /** On-disk inode.
@@ -21,6 +34,7 @@
 struct inode_disk
   {
     bool dir;                               /**< True if is directory */
+    bool compressed;                        /**< True if compressed */
     block_sector_t doubly_indirect_block;   /**< Doubly indirect block. */
     block_sector_t 
     direct_blocks[DIRECT_BLOCK_NUM];        /**< Direct blocks. */
@@ -31,9 +45,19 @@ struct inode_disk
 static inline size_t bytes_to_sectors(off_t);
 static block_sector_t byte_to_sector (const struct inode*, off_t, bool);
 
-static bool inode_allocate (struct inode_disk*, off_t, bool);
-static bool inode_extend (struct inode_disk*, off_t);
-static bool inode_recur_extend (block_sector_t*, size_t, int);
+static bool inode_create_disk (block_sector_t, off_t, bool, bool);
+static bool inode_allocate (struct inode_disk*, off_t, bool, block_sector_t);
+static bool inode_extend (struct inode_disk*, off_t, block_sector_t);
+static bool inode_recur_extend (block_sector_t*, size_t, int, bool,
+                                block_sector_t);
+static block_sector_t inode_unshare (struct inode*, off_t, bool);
+static bool inode_map_slot (struct inode*, size_t);
+static void inode_set_slot (struct inode*, size_t, block_sector_t);
+static off_t inode_read_compressed (struct inode*, uint8_t*, off_t, off_t);
+static off_t inode_write_compressed (struct inode*, const uint8_t*, off_t,
+                                     off_t);
+static bool inode_load_cluster (struct inode*, size_t);
+static bool inode_store_cluster (struct inode*, size_t, off_t);
 static void inode_free (struct inode_disk*);
 static void inode_recur_free (block_sector_t*, size_t, int);
 
@@ -48,6 +72,12 @@ struct inode
     int read_length;                /**< Current length visible to read */
     struct inode_disk data;         /**< Inode content. */
     struct lock lock;               /**< Lock for extension */
+    struct dir_hint dir_hint;       /**< Free slot tracking for dirs. */
+    off_t synced_length;            /**< Length as of the last sync. */
+    uint8_t *cluster;               /**< Decompressed cluster, or null. */
+    uint8_t *scratch;               /**< Compressed cluster and LZ work
+                                         area, allocated with CLUSTER. */
+    size_t cluster_idx;             /**< Index of CLUSTER, or -1. */
   };
 
 /** List of open inodes, so that opening a single inode twice
@@ -68,6 +98,26 @@ inode_init (void)
    Returns false if memory or disk allocation fails. */
 bool
 inode_create (block_sector_t sector, off_t length, bool dir)
+{
+  return inode_create_disk (sector, length, dir, false);
+}
+
+/** Initializes a compressed regular file inode with LENGTH bytes
+   of data and writes the new inode to sector SECTOR on the file
+   system device.  Its data starts out as zeros taking no sectors.
+   Returns true if successful.
+   Returns false if memory or disk allocation fails. */
+bool
+inode_create_compressed (block_sector_t sector, off_t length)
+{
+  return inode_create_disk (sector, length, false, true);
+}
+
+/** Creates an inode at SECTOR, for inode_create() and
+   inode_create_compressed(). */
+static bool
+inode_create_disk (block_sector_t sector, off_t length, bool dir,
+                   bool compressed)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -81,9 +131,11 @@ inode_create (block_sector_t sector, off_t length, bool dir)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      if (inode_allocate (disk_inode, length, dir))
+      disk_inode->compressed = compressed;
+      if (inode_allocate (disk_inode, length, dir, sector))
         {
-          filesys_cache_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+          filesys_cache_write_meta (sector, disk_inode, 0, BLOCK_SECTOR_SIZE,
+                                    sector);
           success = true; 
         } 
       free (disk_inode);
@@ -124,8 +176,13 @@ inode_open (block_sector_t sector)
   inode->deny_write_cnt = 0;
   inode->removed = false;
   lock_init (&inode->lock);
+  inode->dir_hint.free_ofs = 0;
+  inode->dir_hint.free_cnt = -1;
   filesys_cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
   inode->read_length = inode->data.length;
+  inode->synced_length = inode->data.length;
+  inode->cluster = inode->scratch = NULL;
+  inode->cluster_idx = -1;
   return inode;
 }
 
@@ -164,10 +221,13 @@ inode_close (struct inode *inode)
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          journal_begin ();
           free_map_release (inode->sector, 1);
           inode_free (&inode->data);
+          journal_end ();
         }
 
+      free (inode->cluster);
       free (inode); 
     }
 }
@@ -190,6 +250,14 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
 
+  if (inode->data.compressed)
+    {
+      lock_acquire (&inode->lock);
+      bytes_read = inode_read_compressed (inode, buffer, size, offset);
+      lock_release (&inode->lock);
+      return bytes_read;
+    }
+
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -229,23 +297,58 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   bool flag = false;
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
+  /* Directory, free map and reference map contents are metadata. */
+  bool meta = inode_is_dir (inode) || inode->sector == FREE_MAP_SECTOR
+              || inode->sector == REF_MAP_SECTOR;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  journal_begin ();
+  if (inode->data.compressed)
+    {
+      lock_acquire (&inode->lock);
+      bytes_written = inode_write_compressed (inode, buffer, size, offset);
+      lock_release (&inode->lock);
+      journal_end ();
+      return bytes_written;
+    }
+
   /* Position exceeds EOF */
   if (byte_to_sector (inode, size + offset - 1, true) == (block_sector_t) -1)
   {
     flag = true;
     /* Locks for directories are processed in directory.c */
     if (!inode_is_dir (inode)) lock_acquire (&inode->lock);
-    if (!inode_extend (&inode->data, offset + size))
+
+    /* Grow a regular file a chunk at a time, each a consistent
+       state the transaction may commit, so that a long write never
+       pins more metadata than the cache can hold. */
+    while (!meta && offset + size - inode->data.length > EXTEND_CHUNK)
+    {
+      off_t length = inode->data.length + EXTEND_CHUNK;
+      if (!inode_extend (&inode->data, length, inode->sector))
+      {
+        lock_release (&inode->lock);
+        journal_end ();
+        return 0;
+      }
+      inode->data.length = length;
+      filesys_cache_write_meta (inode->sector, &inode->data, 0,
+                                BLOCK_SECTOR_SIZE, inode->sector);
+      lock_release (&inode->lock);
+      journal_restart ();
+      lock_acquire (&inode->lock);
+    }
+    if (!inode_extend (&inode->data, offset + size, inode->sector))
     {
       if (!inode_is_dir (inode)) lock_release (&inode->lock);
+      journal_end ();
       return 0;
     }
     inode->data.length = size + offset;
-    filesys_cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    filesys_cache_write_meta (inode->sector, &inode->data, 0,
+                              BLOCK_SECTOR_SIZE, inode->sector);
   }
 
   while (size > 0) 
@@ -265,8 +368,21 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      filesys_cache_write (sector_idx, buffer+bytes_written, 
-                           sector_ofs, chunk_size);
+      /* Give this file its own copy of a block shared with a clone. */
+      if (free_map_is_shared (sector_idx))
+        {
+          sector_idx = inode_unshare (inode, offset,
+                                      chunk_size < BLOCK_SECTOR_SIZE);
+          if (sector_idx == (block_sector_t) -1)
+            break;
+        }
+
+      if (meta)
+        filesys_cache_write_meta (sector_idx, buffer+bytes_written,
+                                  sector_ofs, chunk_size, inode->sector);
+      else
+        filesys_cache_write (sector_idx, buffer+bytes_written, 
+                             sector_ofs, chunk_size, inode->sector);
 
       /* Advance. */
       size -= chunk_size;
@@ -280,9 +396,186 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     if (!inode_is_dir (inode)) lock_release (&inode->lock);
   }
 
+  journal_end ();
   return bytes_written;
 }
 
+/** Makes DST, an empty regular file, a clone of regular file SRC.
+   DST keeps its own inode and indirect blocks, but shares every
+   data block of SRC until one of them writes to it.  The block map
+   is copied CLONE_CHUNK entries at a time, each step growing DST to
+   cover what it copied, so that the running journal transaction
+   may commit in between.  Must be called inside a journal
+   operation, holding no inode lock.  Writes to SRC while it is
+   cloned may or may not show in DST.
+   Returns true if successful.
+   Returns false if disk allocation fails, leaving DST holding what
+   was cloned so far. */
+bool
+inode_clone (struct inode *src, struct inode *dst)
+{
+  size_t cnt, i = 0;
+  off_t length;
+  bool success = true;
+
+  ASSERT (!inode_is_dir (src) && !inode_is_dir (dst));
+  ASSERT (dst->data.length == 0);
+  lock_acquire (&src->lock);
+  lock_acquire (&dst->lock);
+  length = src->data.length;
+  dst->data.compressed = src->data.compressed;
+  filesys_cache_write_meta (dst->sector, &dst->data, 0, BLOCK_SECTOR_SIZE,
+                            dst->sector);
+  lock_release (&dst->lock);
+  lock_release (&src->lock);
+  cnt = bytes_to_sectors (length);
+
+  while (success && i < cnt)
+    {
+      size_t end = MIN (cnt, i + CLONE_CHUNK);
+
+      lock_acquire (&src->lock);
+      lock_acquire (&dst->lock);
+      for (; i < end; i++)
+        {
+          block_sector_t sector = byte_to_sector (src, i * BLOCK_SECTOR_SIZE,
+                                                  false);
+          /* Holes in compressed files stay holes. */
+          if (sector == 0)
+            continue;
+          if (!inode_map_slot (dst, i) || !free_map_share (sector))
+            {
+              success = false;
+              break;
+            }
+          inode_set_slot (dst, i, sector);
+        }
+      dst->data.length = dst->read_length
+        = MIN (length, (off_t) i * BLOCK_SECTOR_SIZE);
+      filesys_cache_write_meta (dst->sector, &dst->data, 0,
+                                BLOCK_SECTOR_SIZE, dst->sector);
+      lock_release (&dst->lock);
+      lock_release (&src->lock);
+      if (success && i < cnt)
+        journal_restart ();
+    }
+  return success;
+}
+
+/** Counts the data sectors of INODE into *SECTORS, and the runs
+   of consecutive sectors they are laid out in into *EXTENTS. */
+void
+inode_frag_stats (struct inode *inode, size_t *sectors, size_t *extents)
+{
+  size_t cnt = bytes_to_sectors (inode->data.length);
+  block_sector_t prev = 0;
+
+  *sectors = *extents = 0;
+  for (size_t i = 0; i < cnt; i++)
+    {
+      block_sector_t sector = byte_to_sector (inode, i * BLOCK_SECTOR_SIZE,
+                                              false);
+      if (sector == 0)
+        continue;
+      if (*sectors == 0 || sector != prev + 1)
+        (*extents)++;
+      (*sectors)++;
+      prev = sector;
+    }
+}
+
+/** Moves the data of regular file INODE into one contiguous run
+   of free sectors, DEFRAG_BATCH sectors at a time.  Each batch
+   claims its part of the run, copies the data there and writes it
+   to disk, then switches the block map over and frees the old
+   sectors, all in one journal transaction that is committed
+   before the next batch starts.  A crash thus either keeps a
+   batch's old sectors or moves it completely, and never leaks the
+   new ones.
+   Returns false if the file is in use by anyone else, shares
+   blocks with a clone, or no large enough free run exists, or if
+   part of the run was taken by another file before it was
+   claimed.  The batches moved up to then stay moved. */
+bool
+inode_defrag (struct inode *inode)
+{
+  size_t cnt = bytes_to_sectors (inode->data.length);
+  block_sector_t start, old[DEFRAG_BATCH];
+  uint8_t *block;
+  bool success = true;
+
+  if (inode_is_dir (inode) || inode->data.compressed
+      || inode->open_cnt > 1 || cnt == 0)
+    return false;
+  block = malloc (BLOCK_SECTOR_SIZE);
+  if (block == NULL)
+    return false;
+
+  lock_acquire (&inode->lock);
+  for (size_t i = 0; i < cnt && success; i++)
+    if (free_map_is_shared (byte_to_sector (inode, i * BLOCK_SECTOR_SIZE,
+                                            false)))
+      success = false;
+  lock_release (&inode->lock);
+  if (!success || !free_map_find (cnt, &start))
+    {
+      free (block);
+      return false;
+    }
+
+  for (size_t i = 0; i < cnt && success; i += DEFRAG_BATCH)
+    {
+      size_t n = MIN (cnt - i, DEFRAG_BATCH);
+
+      journal_begin ();
+      lock_acquire (&inode->lock);
+      success = free_map_allocate_at (start + i, n);
+      if (success)
+        {
+          /* Copy the data and make sure it is on disk before the
+             block map points at it. */
+          for (size_t j = 0; j < n; j++)
+            {
+              off_t pos = (i + j) * BLOCK_SECTOR_SIZE;
+              old[j] = byte_to_sector (inode, pos, false);
+              filesys_cache_read (old[j], block, 0, BLOCK_SECTOR_SIZE);
+              filesys_cache_write (start + i + j, block, 0,
+                                   BLOCK_SECTOR_SIZE, inode->sector);
+            }
+          filesys_cache_sync (inode->sector);
+
+          for (size_t j = 0; j < n; j++)
+            {
+              inode_set_slot (inode, i + j, start + i + j);
+              free_map_release (old[j], 1);
+            }
+        }
+      lock_release (&inode->lock);
+      journal_end ();
+      if (success)
+        journal_commit ();
+    }
+
+  free (block);
+  return success;
+}
+
+/** Makes the contents of INODE durable.  Its dirty data blocks
+   are written back, and its metadata is committed to the journal.
+   If DATASYNC is true, the journal is only committed if that is
+   needed to read the data back, that is if a regular file grew
+   since it was last synced.  Directory contents are metadata, so
+   they are always committed. */
+void
+inode_sync (struct inode *inode, bool datasync)
+{
+  bool pending = filesys_cache_sync (inode->sector);
+  if (pending && (!datasync || inode_is_dir (inode)
+                  || inode->synced_length != inode->data.length))
+    journal_commit ();
+  inode->synced_length = inode->data.length;
+}
+
 /** Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -294,19 +587,23 @@ inode_deny_write (struct inode *inode)
 
 /** Allocate space for inode */
 static bool 
-inode_allocate (struct inode_disk *disk_inode, off_t length, bool dir)
+inode_allocate (struct inode_disk *disk_inode, off_t length, bool dir,
+                block_sector_t owner)
 {
   disk_inode->dir = dir;
   disk_inode->length = length;
   disk_inode->magic = INODE_MAGIC;
-  return inode_extend (disk_inode, length);
+  if (disk_inode->compressed)
+    return true;
+  return inode_extend (disk_inode, length, owner);
 }
 
 /**
  * Extend the length of the file represented by DISK_INODE by LENGTH. 
- * LENGTH must be positive or zero.
+ * LENGTH must be positive or zero.  OWNER is the inode's sector.
  */
-static bool inode_extend (struct inode_disk *disk_inode, off_t length)
+static bool inode_extend (struct inode_disk *disk_inode, off_t length,
+                          block_sector_t owner)
 {
   static char zeros[BLOCK_SECTOR_SIZE] UNUSED;
   if (length < 0)
@@ -317,24 +614,35 @@ static bool inode_extend (struct inode_disk *disk_inode, off_t length)
 
   /* Use direct blocks */
   for (size_t i=0;i<sector_num;i++)
-    if (!inode_recur_extend (disk_inode->direct_blocks+i, 1, 0))
+    if (!inode_recur_extend (disk_inode->direct_blocks+i, 1, 0,
+                             disk_inode->dir, owner))
       return false;
   sectors -= sector_num;
   if (sectors == 0) return true;
 
   /* We need to use doubly indirect blocks */
-  return inode_recur_extend (&disk_inode->doubly_indirect_block, sectors, 2);
+  return inode_recur_extend (&disk_inode->doubly_indirect_block, sectors, 2,
+                             disk_inode->dir, owner);
 }
 
+/**
+ * Allocate the missing sectors of the K-level block at SECTOR
+ * covering SECTOR_NUM data sectors.  Indirect blocks are always
+ * journaled, data sectors only if META is true.
+ */
 static 
-bool inode_recur_extend (block_sector_t *sector, size_t sector_num, int k)
+bool inode_recur_extend (block_sector_t *sector, size_t sector_num, int k,
+                         bool meta, block_sector_t owner)
 {
   static char zeros[BLOCK_SECTOR_SIZE] = {0};
   if (*sector == 0)
   {
     if (!free_map_allocate (1, sector))
       return false;
-    filesys_cache_write (*sector, zeros, 0, BLOCK_SECTOR_SIZE);
+    if (k > 0 || meta)
+      filesys_cache_write_meta (*sector, zeros, 0, BLOCK_SECTOR_SIZE, owner);
+    else
+      filesys_cache_write (*sector, zeros, 0, BLOCK_SECTOR_SIZE, owner);
   }
   if (k == 0) return true;
   
@@ -349,15 +657,364 @@ bool inode_recur_extend (block_sector_t *sector, size_t sector_num, int k)
   for (size_t i = 0 ;i < entry_num; i++)
   {
     size_t actual_per_entry = MIN (sector_per_entry, sector_num);
-    if (!inode_recur_extend (indirect_block + i, actual_per_entry, k - 1))
+    if (!inode_recur_extend (indirect_block + i, actual_per_entry, k - 1,
+                             meta, owner))
       return false;
     sector_num -= actual_per_entry;
   }
   ASSERT (sector_num == 0);
-  filesys_cache_write (*sector, indirect_block, 0, BLOCK_SECTOR_SIZE);
+  filesys_cache_write_meta (*sector, indirect_block, 0, BLOCK_SECTOR_SIZE,
+                            owner);
+  return true;
+}
+
+/**
+ * Replace the shared data block holding byte POS of INODE with a
+ * private copy.  If COPY is false, the caller overwrites the whole
+ * block and its old content is not copied.
+ * Returns the new sector, or -1 if the disk is full.
+ */
+static block_sector_t
+inode_unshare (struct inode *inode, off_t pos, bool copy)
+{
+  bool locked = lock_held_by_current_thread (&inode->lock);
+  if (!locked) lock_acquire (&inode->lock);
+
+  /* Another writer may have unshared it meanwhile. */
+  block_sector_t sector = byte_to_sector (inode, pos, false);
+  if (free_map_is_shared (sector))
+  {
+    block_sector_t old = sector;
+    if (!free_map_allocate (1, &sector))
+      sector = -1;
+    else
+    {
+      if (copy)
+      {
+        uint8_t block[BLOCK_SECTOR_SIZE];
+        filesys_cache_read (old, block, 0, BLOCK_SECTOR_SIZE);
+        filesys_cache_write (sector, block, 0, BLOCK_SECTOR_SIZE,
+                             inode->sector);
+      }
+      inode_set_slot (inode, pos / BLOCK_SECTOR_SIZE, sector);
+      free_map_release (old, 1);
+    }
+  }
+
+  if (!locked) lock_release (&inode->lock);
+  return sector;
+}
+
+/**
+ * Make sure the indirect blocks holding block map entry IDX of
+ * INODE exist, allocating zeroed ones as needed.
+ */
+static bool
+inode_map_slot (struct inode *inode, size_t idx)
+{
+  static char zeros[BLOCK_SECTOR_SIZE] = {0};
+  block_sector_t l2;
+
+  if (idx < DIRECT_BLOCK_NUM)
+    return true;
+  idx -= DIRECT_BLOCK_NUM;
+  if (inode->data.doubly_indirect_block == 0)
+  {
+    if (!free_map_allocate (1, &inode->data.doubly_indirect_block))
+      return false;
+    filesys_cache_write_meta (inode->data.doubly_indirect_block, zeros, 0,
+                              BLOCK_SECTOR_SIZE, inode->sector);
+    filesys_cache_write_meta (inode->sector, &inode->data, 0,
+                              BLOCK_SECTOR_SIZE, inode->sector);
+  }
+
+  off_t ofs = idx / INDIRECT_BLOCK_NUM * sizeof l2;
+  filesys_cache_read (inode->data.doubly_indirect_block, &l2, ofs, sizeof l2);
+  if (l2 == 0)
+  {
+    if (!free_map_allocate (1, &l2))
+      return false;
+    filesys_cache_write_meta (l2, zeros, 0, BLOCK_SECTOR_SIZE, inode->sector);
+    filesys_cache_write_meta (inode->data.doubly_indirect_block, &l2, ofs,
+                              sizeof l2, inode->sector);
+  }
   return true;
 }
 
+/**
+ * Point block map entry IDX of INODE at SECTOR.  The indirect
+ * blocks holding the entry must exist.
+ */
+static void
+inode_set_slot (struct inode *inode, size_t idx, block_sector_t sector)
+{
+  block_sector_t l2;
+
+  if (idx < DIRECT_BLOCK_NUM)
+  {
+    inode->data.direct_blocks[idx] = sector;
+    filesys_cache_write_meta (inode->sector, &inode->data, 0,
+                              BLOCK_SECTOR_SIZE, inode->sector);
+    return;
+  }
+  idx -= DIRECT_BLOCK_NUM;
+
+  filesys_cache_read (inode->data.doubly_indirect_block, &l2,
+                      idx / INDIRECT_BLOCK_NUM * sizeof l2, sizeof l2);
+  ASSERT (l2 != 0);
+  filesys_cache_write_meta (l2, &sector,
+                            idx % INDIRECT_BLOCK_NUM * sizeof sector,
+                            sizeof sector, inode->sector);
+}
+
+/* Compressed files.
+
+   The data of a compressed file is kept in clusters of
+   CLUSTER_SIZE bytes, cluster C using block map entries from
+   C * CLUSTER_SECTORS on.  A cluster holding LEN bytes of the file
+   is either stored raw in DIV_ROUND_UP (LEN, BLOCK_SECTOR_SIZE)
+   sectors, or compressed into fewer sectors, the first of which
+   starts with the compressed size.  A cluster of zeros takes no
+   sectors at all.  Every write rewrites the clusters it touches,
+   and the last decompressed cluster is kept in the in-memory
+   inode.  All of this happens under the inode lock. */
+
+/** Returns the number of bytes of a file LENGTH bytes long that
+   cluster C holds. */
+static off_t
+cluster_length (off_t length, size_t c)
+{
+  off_t start = (off_t) c * CLUSTER_SIZE;
+  if (length <= start)
+    return 0;
+  return MIN (length - start, CLUSTER_SIZE);
+}
+
+/** Reads SIZE bytes at OFFSET of compressed INODE into BUFFER. */
+static off_t
+inode_read_compressed (struct inode *inode, uint8_t *buffer, off_t size,
+                       off_t offset)
+{
+  off_t bytes_read = 0;
+
+  while (size > 0 && offset < inode->data.length)
+    {
+      size_t c = offset / CLUSTER_SIZE;
+      off_t cluster_ofs = offset % CLUSTER_SIZE;
+      off_t chunk_size = MIN (size, MIN (CLUSTER_SIZE - cluster_ofs,
+                                         inode->data.length - offset));
+      if (!inode_load_cluster (inode, c))
+        break;
+      memcpy (buffer + bytes_read, inode->cluster + cluster_ofs, chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  return bytes_read;
+}
+
+/** Writes SIZE bytes from BUFFER at OFFSET of compressed INODE,
+   growing it as needed.  When growing, the clusters between the
+   old end of file and OFFSET are rewritten too, since the length
+   of their data changes. */
+static off_t
+inode_write_compressed (struct inode *inode, const uint8_t *buffer,
+                        off_t size, off_t offset)
+{
+  off_t length = inode->data.length;
+  off_t end = offset + size, new_length = end > length ? end : length;
+  off_t done = offset;
+  size_t stored = 0;
+
+  if (size <= 0)
+    return 0;
+  for (size_t c = MIN (offset, length) / CLUSTER_SIZE;
+       (off_t) c * CLUSTER_SIZE < end; c++)
+    {
+      off_t start = (off_t) c * CLUSTER_SIZE;
+      off_t from = offset > start ? offset : start;
+      off_t to = MIN (end, start + CLUSTER_SIZE);
+
+      if (!inode_load_cluster (inode, c))
+        break;
+      if (from < to)
+        memcpy (inode->cluster + (from - start), buffer + (from - offset),
+                to - from);
+      if (!inode_store_cluster (inode, c, cluster_length (new_length, c)))
+        {
+          inode->cluster_idx = -1;
+          break;
+        }
+
+      /* Every cluster stored so far matches this length. */
+      if (MIN (new_length, start + CLUSTER_SIZE) > length)
+        length = MIN (new_length, start + CLUSTER_SIZE);
+      if (to > done)
+        done = to;
+
+      /* Commit a batch of clusters at a time, with the length they
+         were stored for, so that a long write or a seek far past the
+         end never pins more metadata than the cache can hold. */
+      if (++stored % COMPRESS_CHUNK == 0 && to < end)
+        {
+          if (length > inode->data.length)
+            {
+              inode->data.length = inode->read_length = length;
+              filesys_cache_write_meta (inode->sector, &inode->data, 0,
+                                        BLOCK_SECTOR_SIZE, inode->sector);
+            }
+          lock_release (&inode->lock);
+          journal_restart ();
+          lock_acquire (&inode->lock);
+          length = inode->data.length;
+          if (length > new_length)
+            new_length = length;
+        }
+    }
+
+  if (length > inode->data.length)
+    {
+      inode->data.length = inode->read_length = length;
+      filesys_cache_write_meta (inode->sector, &inode->data, 0,
+                                BLOCK_SECTOR_SIZE, inode->sector);
+    }
+  return done - offset;
+}
+
+/** Loads cluster C of compressed INODE into its cluster buffer.
+   The buffer is allocated on first use, together with the scratch
+   space inode_store_cluster() compresses into; both are only used
+   with the inode's lock held. */
+static bool
+inode_load_cluster (struct inode *inode, size_t c)
+{
+  block_sector_t sectors[CLUSTER_SECTORS];
+  off_t len = cluster_length (inode->data.length, c);
+  size_t needed = bytes_to_sectors (len), cnt = 0;
+  bool success = true;
+
+  if (inode->cluster == NULL)
+    {
+      inode->cluster = malloc (2 * CLUSTER_SIZE + LZ_WORK_SIZE);
+      if (inode->cluster == NULL)
+        return false;
+      inode->scratch = inode->cluster + CLUSTER_SIZE;
+    }
+  if (inode->cluster_idx == c)
+    return true;
+
+  for (size_t i = 0; i < CLUSTER_SECTORS; i++)
+    if ((sectors[i] = byte_to_sector (inode, (c * CLUSTER_SECTORS + i)
+                                      * BLOCK_SECTOR_SIZE, false)) != 0)
+      cnt = i + 1;
+
+  memset (inode->cluster, 0, CLUSTER_SIZE);
+  if (cnt == needed)
+    {
+      /* Stored raw. */
+      for (size_t i = 0; i < cnt; i++)
+        filesys_cache_read (sectors[i], inode->cluster + i * BLOCK_SECTOR_SIZE,
+                            0, BLOCK_SECTOR_SIZE);
+    }
+  else if (cnt > 0)
+    {
+      uint8_t *z = inode->scratch;
+      uint32_t zlen;
+      for (size_t i = 0; i < cnt; i++)
+        filesys_cache_read (sectors[i], z + i * BLOCK_SECTOR_SIZE,
+                            0, BLOCK_SECTOR_SIZE);
+      memcpy (&zlen, z, sizeof zlen);
+      success = (zlen <= cnt * BLOCK_SECTOR_SIZE - sizeof zlen
+                 && lz_decompress (z + sizeof zlen, zlen, inode->cluster, len));
+    }
+  inode->cluster_idx = success ? c : (size_t) -1;
+  return success;
+}
+
+/** Stores the first LEN bytes of the cluster buffer of compressed
+   INODE as its cluster C.  Sectors are allocated before anything
+   is written, so on failure the cluster on disk is left as it
+   was.  Shared sectors are never written in place.  Compresses
+   into the scratch space loaded with the cluster buffer. */
+static bool
+inode_store_cluster (struct inode *inode, size_t c, off_t len)
+{
+  block_sector_t old[CLUSTER_SECTORS], new[CLUSTER_SECTORS];
+  size_t base = c * CLUSTER_SECTORS, cnt = bytes_to_sectors (len), i;
+  uint8_t *data = inode->cluster, *z = inode->scratch;
+  void *work = inode->scratch + CLUSTER_SIZE;
+
+  /* Pick the smallest representation. */
+  for (i = 0; i < (size_t) len && data[i] == 0; i++)
+    continue;
+  if (i == (size_t) len)
+    cnt = 0;
+  else if (cnt > 1)
+    {
+      uint32_t zlen;
+
+      ASSERT (z != NULL);
+      zlen = lz_compress (data, len, z + sizeof zlen,
+                          (cnt - 1) * BLOCK_SECTOR_SIZE - sizeof zlen, work);
+      if (zlen > 0)
+        {
+          memcpy (z, &zlen, sizeof zlen);
+          cnt = bytes_to_sectors (zlen + sizeof zlen);
+          memset (z + sizeof zlen + zlen, 0,
+                  cnt * BLOCK_SECTOR_SIZE - sizeof zlen - zlen);
+          data = z;
+        }
+    }
+
+  for (i = 0; i < cnt; i++)
+    if (!inode_map_slot (inode, base + i))
+      return false;
+  for (i = 0; i < CLUSTER_SECTORS; i++)
+    old[i] = new[i] = byte_to_sector (inode, (base + i) * BLOCK_SECTOR_SIZE,
+                                      false);
+  for (i = 0; i < cnt; i++)
+    if ((old[i] == 0 || free_map_is_shared (old[i]))
+        && !free_map_allocate (1, &new[i]))
+      {
+        while (i-- > 0)
+          if (new[i] != old[i])
+            free_map_release (new[i], 1);
+        return false;
+      }
+
+  for (i = 0; i < cnt; i++)
+    filesys_cache_write (new[i], data + i * BLOCK_SECTOR_SIZE, 0,
+                         BLOCK_SECTOR_SIZE, inode->sector);
+  for (i = 0; i < CLUSTER_SECTORS; i++)
+    {
+      if (i >= cnt)
+        new[i] = 0;
+      if (new[i] != old[i])
+        {
+          inode_set_slot (inode, base + i, new[i]);
+          if (old[i] != 0)
+            free_map_release (old[i], 1);
+        }
+    }
+  return true;
+}
+
+/** Returns the number of bytes of disk space holding the data of
+   INODE, which is less than its length if it is compressed. */
+off_t
+inode_disk_length (struct inode *inode)
+{
+  size_t cnt = bytes_to_sectors (inode->data.length), used = 0;
+
+  lock_acquire (&inode->lock);
+  for (size_t i = 0; i < cnt; i++)
+    if (byte_to_sector (inode, i * BLOCK_SECTOR_SIZE, false) != 0)
+      used++;
+  lock_release (&inode->lock);
+  return used * BLOCK_SECTOR_SIZE;
+}
+
 /**
  * Free the sectors occupied by DISK_INODE.
  */
@@ -383,7 +1040,9 @@ static void inode_free (struct inode_disk *disk_inode)
 static void 
 inode_recur_free (block_sector_t *sector, size_t sector_num, int k)
 {
-  ASSERT (*sector != 0);
+  /* Compressed files have holes. */
+  if (*sector == 0)
+    return;
   if (k == 0)
     free_map_release (*sector, 1);
   else
@@ -450,6 +1109,20 @@ void inode_lock_release (struct inode *inode)
   lock_release (&inode->lock);
 }
 
+/** Returns the number of openers of INODE. */
+int inode_open_cnt (const struct inode *inode)
+{
+  return inode->open_cnt;
+}
+
+/** Returns the in-memory free slot hint of directory INODE.
+   Must be accessed with the inode lock held. */
+struct dir_hint *inode_dir_hint (struct inode *inode)
+{
+  ASSERT (inode_is_dir (inode));
+  return &inode->dir_hint;
+}
+
 /** Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -472,10 +1145,15 @@ byte_to_sector (const struct inode *inode, off_t pos, bool flag)
     return inode->data.direct_blocks[sector_pos];
   sector_pos -= DIRECT_BLOCK_NUM;
 
-  /** The sector entry is in doubly indirect blocks. */
+  /** The sector entry is in doubly indirect blocks, which a
+      compressed file may not have. */
   block_sector_t indirect_block[INDIRECT_BLOCK_NUM];
+  if (inode->data.doubly_indirect_block == 0)
+    return 0;
   filesys_cache_read (inode->data.doubly_indirect_block, indirect_block,
                       0, BLOCK_SECTOR_SIZE);
+  if (indirect_block [sector_pos / INDIRECT_BLOCK_NUM] == 0)
+    return 0;
   filesys_cache_read (indirect_block [sector_pos / INDIRECT_BLOCK_NUM], 
                       indirect_block, 0, BLOCK_SECTOR_SIZE);
   return indirect_block [sector_pos % INDIRECT_BLOCK_NUM];
@@ -7,23 +7,40 @@
 
 struct bitmap;
 
+/** In-memory bookkeeping kept for directory inodes, so that
+   directory.c does not have to rediscover free slots by scanning
+   the whole directory on every create. */
+struct dir_hint
+  {
+    off_t free_ofs;             /**< No free entry below this offset. */
+    int free_cnt;               /**< Deleted entries, or -1 if unknown. */
+  };
+
 void inode_init (void);
 bool inode_create (block_sector_t, off_t, bool);
+bool inode_create_compressed (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
+bool inode_clone (struct inode *, struct inode *);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_sync (struct inode *, bool datasync);
+void inode_frag_stats (struct inode *, size_t *sectors, size_t *extents);
+bool inode_defrag (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+off_t inode_disk_length (struct inode *);
 
 bool inode_is_removed (const struct inode *);
 bool inode_is_dir (const struct inode *);
 
 void inode_lock_acquire (struct inode *);
 void inode_lock_release (struct inode *);
+int inode_open_cnt (const struct inode *);
+struct dir_hint *inode_dir_hint (struct inode *);
 
 #endif /**< filesys/inode.h */
@@ -0,0 +1,572 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+
+/* Metadata write-ahead journal.
+
+   The journal occupies JOURNAL_SECTOR and the sectors right after
+   it.  The first sector is a header, the rest is a log of
+   transactions.  A transaction is one or more descriptor blocks,
+   each followed by copies of the metadata sectors it lists, and
+   a commit block.  Every block carries the sequence number of its
+   transaction, so replay stops at the first transaction that was
+   never committed or belongs to an older pass over the log.
+
+   Metadata writes from concurrent operations join the running
+   transaction, whose sectors stay pinned in the buffer cache.
+   The transaction is committed with one sequential run of log
+   writes once enough blocks have been batched, when it has no
+   room left for another operation, or on request.  A commit
+   holds new operations back until those in flight have finished,
+   and takes its copies of the sectors before letting them go on,
+   so that a transaction always holds whole operations.  A long
+   operation may let the transaction commit at a point where the
+   file system is consistent with journal_restart().  Committed
+   sectors then reach their home locations whenever the cache
+   writes them back.  When the log is full, it is checkpointed and
+   starts over.
+
+   A logged sector that is freed and reused for file data must not
+   be overwritten by replay, so freeing it records a revoke entry
+   in the running transaction. */
+
+#define JOURNAL_MAGIC 0x4c4e524a        /**< "JRNL" */
+#define JOURNAL_DESC_MAGIC 0x4353454a   /**< "JESC" */
+#define JOURNAL_COMMIT_MAGIC 0x4d4d434a /**< "JCMM" */
+#define JOURNAL_REVOKE 0x80000000       /**< Entry flag: revoked sector */
+
+/* A transaction can pin at most every cache slot. */
+#define JOURNAL_TXN_MAX CACHE_SIZE
+/* Commit once this many sectors are batched. */
+#define JOURNAL_BATCH (CACHE_SIZE / 2)
+/* Sectors an operation may add to the transaction, and how many
+   the transaction may pin at most, leaving the other cache slots
+   to operations reading. */
+#define JOURNAL_OP_CREDITS 8
+#define JOURNAL_PIN_MAX (CACHE_SIZE * 3 / 4)
+#define DESC_ENTRY_CNT ((BLOCK_SECTOR_SIZE - 12) / sizeof (block_sector_t))
+#define JOURNAL_REVOKE_MAX (4 * DESC_ENTRY_CNT)
+#define JOURNAL_MIN_SECTORS (JOURNAL_TXN_MAX + 8)
+#define JOURNAL_MAX_SECTORS 1024
+
+/* Journal header, at JOURNAL_SECTOR. */
+struct journal_header {
+    unsigned magic;             /**< JOURNAL_MAGIC */
+    unsigned seq;               /**< First transaction in the log */
+    uint32_t size;              /**< Journal size in sectors */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 12];
+};
+
+/* Descriptor or commit block in the log. */
+struct journal_block {
+    unsigned magic;             /**< Descriptor or commit magic */
+    unsigned seq;               /**< Transaction sequence number */
+    uint32_t cnt;               /**< Number of entries */
+    block_sector_t sectors[DESC_ENTRY_CNT];   /**< Home locations */
+};
+
+/* A revoke entry found during replay. */
+struct revoke {
+    block_sector_t sector;      /**< Revoked sector */
+    unsigned seq;               /**< Last transaction revoking it */
+};
+
+static struct lock journal_lock;    /**< Protects running transaction */
+static struct lock commit_lock;     /**< Serializes commits */
+
+static block_sector_t txn_sectors[JOURNAL_TXN_MAX];
+static size_t txn_cnt;              /**< Sectors in running txn */
+static block_sector_t txn_revokes[JOURNAL_REVOKE_MAX];
+static size_t txn_revoke_cnt;       /**< Revokes in running txn */
+static unsigned txn_seq;            /**< Running txn sequence number */
+static int active_cnt;              /**< Operations in progress */
+static bool commit_wanted;          /**< A commit waits for operations */
+static struct condition txn_drained;    /**< Signaled at ACTIVE_CNT 0 */
+static struct condition txn_open;       /**< Signaled when a commit has
+                                             taken its copies */
+
+static block_sector_t log_start;    /**< First log sector */
+static block_sector_t log_end;      /**< Sector past the log */
+static block_sector_t log_pos;      /**< Next sector to append to */
+static struct bitmap *logged_map;   /**< Sectors in the log */
+
+/* Buffers used under commit_lock. */
+static struct journal_block jblock;
+static uint8_t jdata[BLOCK_SECTOR_SIZE];
+static uint8_t txn_images[JOURNAL_TXN_MAX][BLOCK_SECTOR_SIZE];
+
+static struct revoke *revokes;      /**< Revokes found by replay */
+static size_t revokes_cnt;
+
+static bool txn_full (void);
+static void journal_write_desc (const block_sector_t *, size_t, unsigned,
+                                uint8_t (*)[BLOCK_SECTOR_SIZE]);
+static void journal_reset (unsigned);
+static void journal_replay (void);
+static block_sector_t journal_scan (block_sector_t, unsigned, bool);
+static void journal_apply (block_sector_t, unsigned);
+static size_t desc_data_cnt (const struct journal_block *);
+static void add_revoke (block_sector_t, unsigned);
+static bool is_revoked (block_sector_t, unsigned);
+
+/**
+ * Returns the number of sectors, header included, that the
+ * journal occupies on the file system device.
+ */
+size_t journal_sectors (void)
+{
+    size_t size = block_size (fs_device) / 32;
+    if (size < JOURNAL_MIN_SECTORS)
+        size = JOURNAL_MIN_SECTORS;
+    if (size > JOURNAL_MAX_SECTORS)
+        size = JOURNAL_MAX_SECTORS;
+    return size;
+}
+
+/**
+ * Initialize the journal.  If FORMAT is true, create an empty
+ * journal, otherwise replay the committed transactions in it.
+ */
+void journal_init (bool format)
+{
+    lock_init (&journal_lock);
+    lock_init (&commit_lock);
+    cond_init (&txn_drained);
+    cond_init (&txn_open);
+    txn_cnt = 0;
+    txn_revoke_cnt = 0;
+    active_cnt = 0;
+    commit_wanted = false;
+    log_start = JOURNAL_SECTOR + 1;
+    log_end = JOURNAL_SECTOR + journal_sectors ();
+    logged_map = bitmap_create (block_size (fs_device));
+    if (logged_map == NULL)
+        PANIC ("journal: bitmap creation failed");
+
+    if (format)
+    {
+        /* Make sure a log left over on the device never replays. */
+        txn_seq = 1;
+        memset (jdata, 0, BLOCK_SECTOR_SIZE);
+        block_write (fs_device, log_start, jdata);
+    }
+    else
+        journal_replay ();
+    journal_reset (txn_seq);
+}
+
+/**
+ * Commit the running transaction and checkpoint the log.
+ */
+void journal_done (void)
+{
+    journal_commit ();
+    lock_acquire (&commit_lock);
+    filesys_cache_checkpoint ();
+    lock_acquire (&journal_lock);
+    unsigned seq = txn_seq;
+    lock_release (&journal_lock);
+    journal_reset (seq);
+    lock_release (&commit_lock);
+}
+
+/**
+ * Start a file system operation.  Its metadata writes will be
+ * committed together.  Waits while a commit is under way, and
+ * commits first if the running transaction has no room left.
+ * Operations started inside another one are part of it.
+ */
+void journal_begin (void)
+{
+    struct thread *cur = thread_current ();
+    if (cur->journal_depth > 0)
+    {
+        cur->journal_depth++;
+        return;
+    }
+    lock_acquire (&journal_lock);
+    while (commit_wanted || txn_full ())
+    {
+        if (commit_wanted)
+            cond_wait (&txn_open, &journal_lock);
+        else
+        {
+            lock_release (&journal_lock);
+            journal_commit ();
+            lock_acquire (&journal_lock);
+        }
+    }
+    active_cnt++;
+    lock_release (&journal_lock);
+    /* Only now, as the commit above must run outside an operation */
+    cur->journal_depth = 1;
+}
+
+/**
+ * Finish a file system operation.  The last operation to finish
+ * commits the running transaction once enough has been batched,
+ * or lets a waiting commit go on.
+ */
+void journal_end (void)
+{
+    ASSERT (thread_current ()->journal_depth > 0);
+    if (--thread_current ()->journal_depth > 0)
+        return;
+    lock_acquire (&journal_lock);
+    ASSERT (active_cnt > 0);
+    bool commit = --active_cnt == 0 && txn_cnt >= JOURNAL_BATCH;
+    if (active_cnt == 0)
+        cond_broadcast (&txn_drained, &journal_lock);
+    lock_release (&journal_lock);
+    if (commit)
+        journal_commit ();
+}
+
+/**
+ * Finish the current operation and start another, so that the
+ * running transaction may commit in between.  The caller must
+ * leave the file system consistent and hold no lock that another
+ * operation may wait for.  Does nothing in a nested operation.
+ */
+void journal_restart (void)
+{
+    if (thread_current ()->journal_depth > 1)
+        return;
+    journal_end ();
+    journal_begin ();
+}
+
+/**
+ * Add metadata sector SECTOR to the running transaction.
+ * Returns the sequence number of the transaction.
+ * Called with the cache slot of SECTOR locked and pinned.
+ */
+unsigned journal_add (block_sector_t sector)
+{
+    lock_acquire (&journal_lock);
+    ASSERT (active_cnt > 0);
+    size_t i;
+    for (i = 0; i < txn_cnt; i++)
+        if (txn_sectors[i] == sector)
+            break;
+    if (i == txn_cnt)
+    {
+        ASSERT (txn_cnt < JOURNAL_TXN_MAX);
+        txn_sectors[txn_cnt++] = sector;
+    }
+    /* Reallocated as metadata: this copy supersedes the revoke. */
+    for (i = 0; i < txn_revoke_cnt; i++)
+        if (txn_revokes[i] == sector)
+            txn_revokes[i--] = txn_revokes[--txn_revoke_cnt];
+    unsigned seq = txn_seq;
+    lock_release (&journal_lock);
+    return seq;
+}
+
+/**
+ * Record that SECTOR has been freed, so that replay does not
+ * overwrite it with an older logged copy once it is reused.
+ */
+void journal_revoke (block_sector_t sector)
+{
+    lock_acquire (&journal_lock);
+    bool in_txn = false;
+    for (size_t i = 0; i < txn_cnt; i++)
+        if (txn_sectors[i] == sector)
+            in_txn = true;
+    if (in_txn || bitmap_test (logged_map, sector))
+    {
+        /* journal_begin() leaves room for an operation's revokes */
+        ASSERT (txn_revoke_cnt < JOURNAL_REVOKE_MAX);
+        txn_revokes[txn_revoke_cnt++] = sector;
+    }
+    lock_release (&journal_lock);
+}
+
+/**
+ * Commit the running transaction to the log, then release its
+ * sectors so the cache may write them back to their homes.
+ * Must not be called inside an operation.
+ */
+void journal_commit (void)
+{
+    static block_sector_t sectors[JOURNAL_TXN_MAX];
+    static block_sector_t logged_at[JOURNAL_TXN_MAX];
+    static block_sector_t revoked[JOURNAL_REVOKE_MAX];
+    size_t cnt, revoke_cnt, needed;
+    unsigned seq;
+
+    ASSERT (thread_current ()->journal_depth == 0);
+    lock_acquire (&commit_lock);
+
+    /* Close the running transaction once the operations in it are
+       finished; later writes join the next. */
+    lock_acquire (&journal_lock);
+    commit_wanted = true;
+    while (active_cnt > 0)
+        cond_wait (&txn_drained, &journal_lock);
+    cnt = txn_cnt;
+    revoke_cnt = txn_revoke_cnt;
+    seq = txn_seq;
+    memcpy (sectors, txn_sectors, cnt * sizeof *sectors);
+    memcpy (revoked, txn_revokes, revoke_cnt * sizeof *revoked);
+    /* Freeing these from now on must revoke them. */
+    for (size_t i = 0; i < cnt; i++)
+        bitmap_mark (logged_map, sectors[i]);
+    if (cnt + revoke_cnt > 0)
+    {
+        txn_cnt = 0;
+        txn_revoke_cnt = 0;
+        txn_seq++;
+    }
+    lock_release (&journal_lock);
+
+    /* Copy the sectors as the transaction left them, before new
+       operations change them. */
+    for (size_t i = 0; i < cnt; i++)
+        filesys_cache_snapshot (sectors[i], txn_images[i]);
+    lock_acquire (&journal_lock);
+    commit_wanted = false;
+    cond_broadcast (&txn_open, &journal_lock);
+    lock_release (&journal_lock);
+    if (cnt + revoke_cnt == 0)
+        goto done;
+
+    /* Make room in the log by checkpointing everything committed
+       so far.  Nothing is left to revoke in an empty log. */
+    needed = DIV_ROUND_UP (cnt, DESC_ENTRY_CNT) + cnt + 2
+             + DIV_ROUND_UP (revoke_cnt, DESC_ENTRY_CNT);
+    if (log_pos + needed > log_end)
+    {
+        filesys_cache_checkpoint ();
+        lock_acquire (&journal_lock);
+        journal_reset (seq);
+        for (size_t i = 0; i < cnt; i++)
+            bitmap_mark (logged_map, sectors[i]);
+        lock_release (&journal_lock);
+        revoke_cnt = 0;
+    }
+
+    /* Revokes, descriptors and data, then the commit block. */
+    for (size_t i = 0; i < revoke_cnt; i++)
+        revoked[i] |= JOURNAL_REVOKE;
+    for (size_t i = 0; i < revoke_cnt; i += DESC_ENTRY_CNT)
+    {
+        size_t n = revoke_cnt - i < DESC_ENTRY_CNT
+                   ? revoke_cnt - i : DESC_ENTRY_CNT;
+        journal_write_desc (revoked + i, n, seq, NULL);
+    }
+    for (size_t i = 0; i < cnt; i += DESC_ENTRY_CNT)
+    {
+        size_t n = cnt - i < DESC_ENTRY_CNT ? cnt - i : DESC_ENTRY_CNT;
+        for (size_t j = 0; j < n; j++)
+            logged_at[i + j] = log_pos + 1 + j;
+        journal_write_desc (sectors + i, n, seq, txn_images + i);
+    }
+    /* Only once all of the above is on disk */
+    memset (&jblock, 0, sizeof jblock);
+    jblock.magic = JOURNAL_COMMIT_MAGIC;
+    jblock.seq = seq;
+    jblock.cnt = cnt;
+    block_write (fs_device, log_pos++, &jblock);
+
+    for (size_t i = 0; i < cnt; i++)
+        filesys_cache_unpin (sectors[i], seq, logged_at[i]);
+done:
+    lock_release (&commit_lock);
+}
+
+/* Helper functions */
+
+/**
+ * Returns true if the running transaction has no room left for
+ * another operation's sectors and revokes.
+ * Called with journal_lock held.
+ */
+static bool txn_full (void)
+{
+    return txn_cnt + (active_cnt + 1) * JOURNAL_OP_CREDITS > JOURNAL_PIN_MAX
+           || txn_revoke_cnt > JOURNAL_REVOKE_MAX / 2;
+}
+
+/**
+ * Append a descriptor block listing the CNT entries in SECTORS
+ * for transaction SEQ, followed by the CNT sector images at IMAGES
+ * unless it is null, in one write.
+ */
+static void
+journal_write_desc (const block_sector_t *sectors, size_t cnt, unsigned seq,
+                    uint8_t (*images)[BLOCK_SECTOR_SIZE])
+{
+    struct block_iovec iov[2];
+
+    memset (&jblock, 0, sizeof jblock);
+    jblock.magic = JOURNAL_DESC_MAGIC;
+    jblock.seq = seq;
+    jblock.cnt = cnt;
+    memcpy (jblock.sectors, sectors, cnt * sizeof *sectors);
+    iov[0].buffer = &jblock;
+    iov[0].cnt = 1;
+    iov[1].buffer = images;
+    iov[1].cnt = cnt;
+    block_writev (fs_device, log_pos, iov, images != NULL ? 2 : 1);
+    log_pos += 1 + (images != NULL ? cnt : 0);
+}
+
+/**
+ * Write a header that starts the log over with transaction SEQ.
+ * Everything in the log must have been checkpointed.
+ */
+static void journal_reset (unsigned seq)
+{
+    struct journal_header *h = (struct journal_header *) jdata;
+    memset (h, 0, sizeof *h);
+    h->magic = JOURNAL_MAGIC;
+    h->seq = seq;
+    h->size = journal_sectors ();
+    block_write (fs_device, JOURNAL_SECTOR, h);
+    log_pos = log_start;
+    bitmap_set_all (logged_map, false);
+}
+
+/**
+ * Replay every committed transaction in the log, writing the
+ * logged sectors straight to their home locations.
+ */
+static void journal_replay (void)
+{
+    struct journal_header *h = (struct journal_header *) jdata;
+    block_sector_t pos, next;
+    unsigned first_seq, seq;
+
+    block_read (fs_device, JOURNAL_SECTOR, h);
+    if (h->magic != JOURNAL_MAGIC || h->size != journal_sectors ())
+        PANIC ("journal: no valid journal found, format the file system");
+    first_seq = h->seq;
+
+    /* First pass finds the committed transactions and collects
+       their revokes, second pass applies them in order. */
+    revokes = NULL;
+    revokes_cnt = 0;
+    for (pos = log_start, seq = first_seq;
+         (next = journal_scan (pos, seq, true)) != 0; pos = next)
+        seq++;
+    txn_seq = seq;
+    for (pos = log_start, seq = first_seq; seq != txn_seq; seq++)
+    {
+        journal_apply (pos, seq);
+        pos = journal_scan (pos, seq, false);
+    }
+    free (revokes);
+
+    if (txn_seq != first_seq)
+        printf ("journal: replayed %u transaction(s)\n", txn_seq - first_seq);
+}
+
+/**
+ * Check that a complete transaction SEQ starts at log sector POS.
+ * Returns the sector after its commit block, or 0 if there is
+ * none.  If COLLECT is true, remembers the revokes it contains.
+ */
+static block_sector_t
+journal_scan (block_sector_t pos, unsigned seq, bool collect)
+{
+    size_t data_cnt = 0;
+    while (pos < log_end)
+    {
+        block_read (fs_device, pos++, &jblock);
+        if (jblock.seq != seq || jblock.cnt > DESC_ENTRY_CNT)
+            return 0;
+        if (jblock.magic == JOURNAL_COMMIT_MAGIC)
+            return jblock.cnt == data_cnt ? pos : 0;
+        if (jblock.magic != JOURNAL_DESC_MAGIC)
+            return 0;
+        if (collect)
+            for (size_t i = 0; i < jblock.cnt; i++)
+                if (jblock.sectors[i] & JOURNAL_REVOKE)
+                    add_revoke (jblock.sectors[i] & ~JOURNAL_REVOKE, seq);
+        size_t n = desc_data_cnt (&jblock);
+        data_cnt += n;
+        pos += n;
+    }
+    return 0;
+}
+
+/**
+ * Write the sectors logged by transaction SEQ, which starts at
+ * log sector POS, to their home locations.
+ */
+static void journal_apply (block_sector_t pos, unsigned seq)
+{
+    static struct journal_block desc;
+    while (true)
+    {
+        block_read (fs_device, pos++, &desc);
+        if (desc.magic == JOURNAL_COMMIT_MAGIC)
+            return;
+        for (size_t i = 0; i < desc.cnt; i++)
+        {
+            block_sector_t sector = desc.sectors[i];
+            if (sector & JOURNAL_REVOKE)
+                continue;
+            block_read (fs_device, pos++, jdata);
+            if (!is_revoked (sector, seq))
+                block_write (fs_device, sector, jdata);
+        }
+    }
+}
+
+/**
+ * Returns the number of data sectors following descriptor D.
+ */
+static size_t desc_data_cnt (const struct journal_block *d)
+{
+    size_t cnt = 0;
+    for (size_t i = 0; i < d->cnt; i++)
+        if (!(d->sectors[i] & JOURNAL_REVOKE))
+            cnt++;
+    return cnt;
+}
+
+/**
+ * Remember that SECTOR was revoked by transaction SEQ.
+ */
+static void add_revoke (block_sector_t sector, unsigned seq)
+{
+    static size_t capacity;
+    for (size_t i = 0; i < revokes_cnt; i++)
+        if (revokes[i].sector == sector)
+        {
+            revokes[i].seq = seq;
+            return;
+        }
+    if (revokes_cnt == capacity)
+    {
+        capacity = capacity ? capacity * 2 : 16;
+        revokes = realloc (revokes, capacity * sizeof *revokes);
+        if (revokes == NULL)
+            PANIC ("journal: out of memory during replay");
+    }
+    revokes[revokes_cnt].sector = sector;
+    revokes[revokes_cnt++].seq = seq;
+}
+
+/**
+ * Returns true if SECTOR was revoked by transaction SEQ or a
+ * later one, so its copy in transaction SEQ must not be replayed.
+ */
+static bool is_revoked (block_sector_t sector, unsigned seq)
+{
+    for (size_t i = 0; i < revokes_cnt; i++)
+        if (revokes[i].sector == sector)
+            return revokes[i].seq >= seq;
+    return false;
+}
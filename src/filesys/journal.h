@@ -0,0 +1,18 @@
+#ifndef __FILESYS_JOURNAL_H
+#define __FILESYS_JOURNAL_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <devices/block.h>
+
+size_t journal_sectors (void);
+void journal_init (bool);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_restart (void);
+unsigned journal_add (block_sector_t);
+void journal_revoke (block_sector_t);
+void journal_commit (void);
+
+#endif
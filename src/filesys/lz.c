@@ -0,0 +1,182 @@
+#include "filesys/lz.h"
+#include <debug.h>
+#include <string.h>
+
+/* A byte-oriented LZ77 codec in the style of LZ4.
+
+   The compressed stream is a series of sequences.  Each starts
+   with a token byte whose high nibble is the number of literals
+   and whose low nibble is the match length minus LZ_MIN_MATCH.
+   A nibble of 15 is followed by more length bytes, each added to
+   it, until one is less than 255.  The literals follow, then the
+   match offset as two little-endian bytes.  The last sequence
+   ends after its literals and has no match. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+static uint8_t *put_len (uint8_t *, uint8_t *, size_t);
+static bool get_len (const uint8_t **, const uint8_t *, size_t *);
+static uint8_t *put_sequence (uint8_t *, uint8_t *, const uint8_t *, size_t,
+                              size_t, size_t);
+
+static inline uint32_t read32 (const uint8_t *p)
+{
+    uint32_t v;
+    memcpy (&v, p, sizeof v);
+    return v;
+}
+
+static inline uint32_t hash (const uint8_t *p)
+{
+    return (read32 (p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Compress SIZE bytes from SRC into at most CAP bytes at DST,
+ * using LZ_WORK_SIZE bytes of scratch memory at WORK.
+ * Returns the compressed size, or 0 if it would exceed CAP.
+ */
+size_t lz_compress (const void *src_, size_t size, void *dst_, size_t cap,
+                    void *work)
+{
+    const uint8_t *src = src_, *ip = src, *anchor = src, *end = src + size;
+    uint8_t *op = dst_, *op_end = op + cap;
+    uint16_t *table = work;
+
+    ASSERT (size <= LZ_MAX_INPUT);
+    memset (table, 0, LZ_WORK_SIZE);
+    while (ip + LZ_MIN_MATCH <= end)
+    {
+        uint32_t h = hash (ip);
+        const uint8_t *ref = src + table[h];
+        table[h] = ip - src;
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET
+            || read32 (ref) != read32 (ip))
+        {
+            ip++;
+            continue;
+        }
+
+        /* Extend the match as far as it goes. */
+        const uint8_t *m = ip + LZ_MIN_MATCH, *r = ref + LZ_MIN_MATCH;
+        while (m < end && *m == *r)
+            m++, r++;
+        op = put_sequence (op, op_end, anchor, ip - anchor, ip - ref, m - ip);
+        if (op == NULL)
+            return 0;
+        ip = anchor = m;
+    }
+    op = put_sequence (op, op_end, anchor, end - anchor, 0, 0);
+    return op != NULL ? op - (uint8_t *) dst_ : 0;
+}
+
+/**
+ * Decompress SIZE bytes from SRC into exactly LEN bytes at DST.
+ * Returns false if SRC is not a valid stream of that length.
+ */
+bool lz_decompress (const void *src_, size_t size, void *dst_, size_t len)
+{
+    const uint8_t *ip = src_, *end = ip + size;
+    uint8_t *dst = dst_, *op = dst, *op_end = dst + len;
+
+    while (ip < end)
+    {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4, match = token & 15, offset;
+
+        if (lit == 15 && !get_len (&ip, end, &lit))
+            return false;
+        if (lit > (size_t) (end - ip) || lit > (size_t) (op_end - op))
+            return false;
+        memcpy (op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return false;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (match == 15 && !get_len (&ip, end, &match))
+            return false;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t) (op - dst)
+            || match > (size_t) (op_end - op))
+            return false;
+
+        /* Byte by byte, as the match may overlap its own output. */
+        for (const uint8_t *r = op - offset; match > 0; match--)
+            *op++ = *r++;
+    }
+    return op == op_end;
+}
+
+/* Helper functions */
+
+/**
+ * Append one sequence of LIT_LEN literals from LIT followed by a
+ * match of MATCH bytes at OFFSET, or no match if MATCH is 0.
+ * Returns the new output position, or NULL if past OP_END.
+ */
+static uint8_t *put_sequence (uint8_t *op, uint8_t *op_end,
+                              const uint8_t *lit, size_t lit_len,
+                              size_t offset, size_t match)
+{
+    if (op >= op_end)
+        return NULL;
+    uint8_t *token = op++;
+    *token = (lit_len < 15 ? lit_len : 15) << 4;
+    if (lit_len >= 15 && (op = put_len (op, op_end, lit_len - 15)) == NULL)
+        return NULL;
+    if ((size_t) (op_end - op) < lit_len)
+        return NULL;
+    memcpy (op, lit, lit_len);
+    op += lit_len;
+
+    if (match == 0)
+        return op;
+    if (op_end - op < 2)
+        return NULL;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    match -= LZ_MIN_MATCH;
+    *token |= match < 15 ? match : 15;
+    if (match >= 15)
+        op = put_len (op, op_end, match - 15);
+    return op;
+}
+
+/**
+ * Append the extra length bytes for LEN.
+ * Returns the new output position, or NULL if past OP_END.
+ */
+static uint8_t *put_len (uint8_t *op, uint8_t *op_end, size_t len)
+{
+    for (;; len -= 255)
+    {
+        if (op >= op_end)
+            return NULL;
+        *op++ = len < 255 ? len : 255;
+        if (len < 255)
+            return op;
+    }
+}
+
+/**
+ * Add the extra length bytes at *IP to *LEN.
+ * Returns false if they run past END.
+ */
+static bool get_len (const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+    uint8_t b;
+    do
+    {
+        if (*ip >= end)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
@@ -0,0 +1,17 @@
+#ifndef __FILESYS_LZ_H
+#define __FILESYS_LZ_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Scratch memory lz_compress() needs, in bytes. */
+#define LZ_HASH_BITS 11
+#define LZ_WORK_SIZE ((1 << LZ_HASH_BITS) * sizeof (uint16_t))
+
+/* Largest input lz_compress() accepts. */
+#define LZ_MAX_INPUT 65536
+
+size_t lz_compress (const void *, size_t, void *, size_t, void *work);
+bool lz_decompress (const void *, size_t, void *, size_t);
+
+#endif
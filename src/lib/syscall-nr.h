@@ -28,7 +28,14 @@ enum
     SYS_MKDIR,                  /**< Create a directory. */
     SYS_READDIR,                /**< Reads a directory entry. */
     SYS_ISDIR,                  /**< Tests if a fd represents a directory. */
-    SYS_INUMBER                 /**< Returns the inode number for a fd. */
+    SYS_INUMBER,                /**< Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FSYNC,                  /**< Make a file durable. */
+    SYS_FDATASYNC,              /**< Make a file's data durable. */
+    SYS_CLONE,                  /**< Clone a file copy-on-write. */
+    SYS_CREATE_COMPRESSED,      /**< Create a compressed file. */
+    SYS_DISKSIZE                /**< Obtain a file's size on disk. */
   };
 
 /** Numbers of parameters for each syscall. Defined in userprog/syscall.c */
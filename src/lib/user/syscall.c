@@ -182,3 +182,33 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+int
+fdatasync (int fd)
+{
+  return syscall1 (SYS_FDATASYNC, fd);
+}
+
+bool
+clone (const char *src, const char *dst)
+{
+  return syscall2 (SYS_CLONE, src, dst);
+}
+
+bool
+create_compressed (const char *file, unsigned initial_size)
+{
+  return syscall2 (SYS_CREATE_COMPRESSED, file, initial_size);
+}
+
+int
+disksize (int fd)
+{
+  return syscall1 (SYS_DISKSIZE, fd);
+}
@@ -45,4 +45,11 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/** Extensions. */
+int fsync (int fd);
+int fdatasync (int fd);
+bool clone (const char *src, const char *dst);
+bool create_compressed (const char *file, unsigned initial_size);
+int disksize (int fd);
+
 #endif /**< lib/user/syscall.h */
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($original) = join ('', map {
+    my ($c) = $_;
+    join ('', map { chr (ord ('a') + ($_ + $c) % 26) } 0...4095);
+} 0...1023);
+my ($clone) = $original;
+substr ($clone, 517 * 4096, 4096) = 'x' x 4096;
+check_archive ({"original" => [$original], "clone" => [$clone]});
+pass;
@@ -0,0 +1,77 @@
+/** Clones a compressed file whose block map spans more indirect
+   blocks than one journal transaction can hold, overwrites part
+   of the clone, and checks that the original keeps its contents.
+   The data compresses well, so the files take little disk space. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK 4096              /* Bytes per write and read. */
+#define CHUNK_CNT 1024          /* 4 MB in all. */
+#define CHANGED 517             /* Chunk overwritten in the clone. */
+
+static char buf[CHUNK];
+static char expected[CHUNK];
+
+/* Fills P with the contents of chunk C of the original. */
+static void
+fill (char *p, size_t c)
+{
+  for (size_t i = 0; i < CHUNK; i++)
+    p[i] = 'a' + (i + c) % 26;
+}
+
+/* Checks that NAME holds the original contents, except for chunk
+   CHANGED being all 'x' if CHANGED is true. */
+static void
+check (const char *name, bool changed)
+{
+  int fd;
+
+  CHECK ((fd = open (name)) > 1, "open \"%s\" for verification", name);
+  for (size_t c = 0; c < CHUNK_CNT; c++)
+    {
+      fill (expected, c);
+      if (changed && c == CHANGED)
+        memset (expected, 'x', CHUNK);
+      if (read (fd, buf, CHUNK) != CHUNK)
+        fail ("read chunk %zu of \"%s\" failed", c, name);
+      if (memcmp (buf, expected, CHUNK))
+        fail ("chunk %zu of \"%s\" differs", c, name);
+    }
+  msg ("verified contents of \"%s\"", name);
+  msg ("close \"%s\"", name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  CHECK (create_compressed ("original", 0), "create \"original\" compressed");
+  CHECK ((fd = open ("original")) > 1, "open \"original\"");
+  for (size_t c = 0; c < CHUNK_CNT; c++)
+    {
+      fill (buf, c);
+      if (write (fd, buf, CHUNK) != CHUNK)
+        fail ("write chunk %zu of \"original\" failed", c);
+    }
+  msg ("write \"original\"");
+  msg ("close \"original\"");
+  close (fd);
+
+  CHECK (clone ("original", "clone"), "clone \"original\" to \"clone\"");
+  CHECK ((fd = open ("clone")) > 1, "open \"clone\"");
+  seek (fd, CHANGED * CHUNK);
+  memset (buf, 'x', CHUNK);
+  CHECK (write (fd, buf, CHUNK) == CHUNK, "overwrite \"clone\"");
+  msg ("close \"clone\"");
+  close (fd);
+
+  check ("original", false);
+  check ("clone", true);
+}
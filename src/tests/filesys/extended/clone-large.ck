@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(clone-large) begin
+(clone-large) create "original" compressed
+(clone-large) open "original"
+(clone-large) write "original"
+(clone-large) close "original"
+(clone-large) clone "original" to "clone"
+(clone-large) open "clone"
+(clone-large) overwrite "clone"
+(clone-large) close "clone"
+(clone-large) open "original" for verification
+(clone-large) verified contents of "original"
+(clone-large) close "original"
+(clone-large) open "clone" for verification
+(clone-large) verified contents of "clone"
+(clone-large) close "clone"
+(clone-large) end
+EOF
+pass;
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($original) = random_bytes (5678);
+my ($clone) = $original;
+substr ($clone, 1000, 2000) = 'x' x 2000;
+check_archive ({"original" => [$original], "clone" => [$clone]});
+pass;
@@ -0,0 +1,38 @@
+/** Clones a file, overwrites part of the clone, and checks that
+   the original keeps its contents. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5678];
+static char buf2[sizeof buf];
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  memcpy (buf2, buf, sizeof buf);
+  memset (buf2 + 1000, 'x', 2000);
+
+  CHECK (create ("original", 0), "create \"original\"");
+  CHECK ((fd = open ("original")) > 1, "open \"original\"");
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"original\"");
+  msg ("close \"original\"");
+  close (fd);
+
+  CHECK (clone ("original", "clone"), "clone \"original\" to \"clone\"");
+  CHECK ((fd = open ("clone")) > 1, "open \"clone\"");
+  seek (fd, 1000);
+  CHECK (write (fd, buf2 + 1000, 2000) == 2000, "overwrite \"clone\"");
+  msg ("close \"clone\"");
+  close (fd);
+
+  check_file ("original", buf, sizeof buf);
+  check_file ("clone", buf2, sizeof buf2);
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(clone) begin
+(clone) create "original"
+(clone) open "original"
+(clone) write "original"
+(clone) close "original"
+(clone) clone "original" to "clone"
+(clone) open "clone"
+(clone) overwrite "clone"
+(clone) close "clone"
+(clone) open "original" for verification
+(clone) verified contents of "original"
+(clone) close "original"
+(clone) open "clone" for verification
+(clone) verified contents of "clone"
+(clone) close "clone"
+(clone) end
+EOF
+pass;
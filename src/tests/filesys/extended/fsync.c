@@ -0,0 +1,32 @@
+/** Grows a file, makes it durable with fsync, overwrites part
+   of it and makes that durable with fdatasync.  The kernel runs
+   with -nosync, so the persistence check sees only what the two
+   calls wrote back. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5678];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testme";
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"%s\"", file_name);
+  CHECK (fsync (fd) == 0, "fsync \"%s\"", file_name);
+  seek (fd, 1000);
+  CHECK (write (fd, buf + 1000, 2000) == 2000,
+         "overwrite \"%s\"", file_name);
+  CHECK (fdatasync (fd) == 0, "fdatasync \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync) begin
+(fsync) create "testme"
+(fsync) open "testme"
+(fsync) write "testme"
+(fsync) fsync "testme"
+(fsync) overwrite "testme"
+(fsync) fdatasync "testme"
+(fsync) close "testme"
+(fsync) open "testme" for verification
+(fsync) verified contents of "testme"
+(fsync) close "testme"
+(fsync) end
+EOF
+pass;
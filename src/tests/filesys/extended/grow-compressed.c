@@ -0,0 +1,35 @@
+/** Grows a compressed file with compressible data, first by a
+   small write and then by one write whose block map spans more
+   indirect blocks than one journal transaction can hold, and
+   checks that it reads back intact while taking less disk space
+   than its length. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FIRST 10000             /* Bytes in the first write. */
+
+static char buf[4000000];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testme";
+  int fd, size;
+
+  for (size_t i = 0; i < sizeof buf; i++)
+    buf[i] = "abcdefghij"[i % 10];
+  CHECK (create_compressed (file_name, 0), "create \"%s\" compressed",
+         file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, FIRST) == FIRST, "write \"%s\"", file_name);
+  CHECK (write (fd, buf + FIRST, sizeof buf - FIRST)
+         == (int) (sizeof buf - FIRST), "write rest of \"%s\"", file_name);
+  size = disksize (fd);
+  if (size <= 0 || size >= filesize (fd))
+    fail ("disk size %d should be less than length %d", size, filesize (fd));
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
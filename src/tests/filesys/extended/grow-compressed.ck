@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-compressed) begin
+(grow-compressed) create "testme" compressed
+(grow-compressed) open "testme"
+(grow-compressed) write "testme"
+(grow-compressed) write rest of "testme"
+(grow-compressed) close "testme"
+(grow-compressed) open "testme" for verification
+(grow-compressed) verified contents of "testme"
+(grow-compressed) close "testme"
+(grow-compressed) end
+EOF
+pass;
@@ -34,10 +34,14 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/iotrace.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
 #include "vm/frame.h"
+#include "vm/page.h"
 #include "vm/swap.h"
 
 /** Page directory with kernel mappings only. */
@@ -127,12 +131,16 @@ pintos_init (void)
 
 #ifdef FILESYS
   /* Initialize file system. */
+  iotrace_init ();
+  ramdisk_init ();
   ide_init ();
+  virtio_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
 
 #ifdef VM
+  page_init ();
   frame_table_init ();
   swap_init ();
 #endif 
@@ -326,9 +334,31 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        {
+          if (value == NULL || !ramdisk_configure (value))
+            PANIC ("bad RAM disk `%s' (use ROLE:SIZE)",
+                   value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-iostat"))
+        block_set_iostats_at_shutdown (true);
+      else if (!strcmp (name, "-nosync"))
+        filesys_set_sync_at_shutdown (false);
+      else if (!strcmp (name, "-iotrace"))
+        {
+          if (!iotrace_configure (value))
+            PANIC ("unknown I/O trace destination `%s'", value);
+        }
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (value == NULL || !block_set_scheduler (value))
+            PANIC ("unknown I/O scheduler `%s'", value != NULL ? value : "");
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-fault-around"))
+        set_fault_around (value != NULL ? atoi (value) : 0);
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
@@ -393,6 +423,9 @@ run_actions (char **argv)
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
       {"rm", 2, fsutil_rm},
+      {"clone", 3, fsutil_clone},
+      {"defrag", 1, fsutil_defrag},
+      {"iostat", 1, fsutil_iostat},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
 #endif
@@ -441,6 +474,9 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  clone SRC DST      Make DST a copy-on-write clone of SRC.\n"
+          "  defrag             Move fragmented files into contiguous sectors.\n"
+          "  iostat             Print disk latency and queue statistics.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -453,8 +489,15 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=ROLE:SIZE Create a SIZE (e.g. 512K, 8M) RAM disk for ROLE.\n"
+          "  -iosched=NAME      Order disk requests with NAME (clook, fifo).\n"
+          "  -iostat            Print disk latency statistics at shutdown.\n"
+          "  -nosync            Power off without writing back the file system.\n"
+          "  -iotrace[=DEST]    Trace disk requests, dump to DEST at shutdown\n"
+          "                     (console, scratch).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -fault-around=N    Map up to N file pages per fault (1 to 16).\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
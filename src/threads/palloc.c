@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,6 +33,10 @@ struct pool
     struct lock lock;                   /**< Mutual exclusion. */
     struct bitmap *used_map;            /**< Bitmap of free pages. */
     uint8_t *base;                      /**< Base of pool. */
+    size_t free_cnt;                    /**< Number of free pages, updated
+                                             with interrupts off, since
+                                             pages are freed while
+                                             switching threads. */
   };
 
 /** Two pools: one for kernel data, one for user pages. */
@@ -39,7 +44,8 @@ static struct pool kernel_pool, user_pool;
 
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
-static bool page_from_pool (const struct pool *, void *page);
+static bool page_from_pool (const struct pool *, const void *page);
+static void add_free_cnt (struct pool *, size_t delta);
 
 /** Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -81,6 +87,8 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   lock_acquire (&pool->lock);
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
   lock_release (&pool->lock);
+  if (page_idx != BITMAP_ERROR)
+    add_free_cnt (pool, -page_cnt);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -144,6 +152,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  add_free_cnt (pool, page_cnt);
 }
 
 /** Frees the page at PAGE. */
@@ -152,10 +161,48 @@ palloc_free_page (void *page)
 {
   /* remove frame entry if page is from user pool */
 #ifdef VM
-  if (page_from_pool (&user_pool, page))
+  bool user = page_from_pool (&user_pool, page);
+  if (user)
     remove_frame (page);  
 #endif
   palloc_free_multiple (page, 1);
+#ifdef VM
+  if (user)
+    frame_freed ();
+#endif
+}
+
+/** Returns the number of pages in the user pool. */
+size_t
+palloc_user_page_cnt (void)
+{
+  return bitmap_size (user_pool.used_map);
+}
+
+/** Returns the number of free pages in the user pool.  The count
+   may be stale by the time the caller looks at it. */
+size_t
+palloc_user_free_cnt (void)
+{
+  return user_pool.free_cnt;
+}
+
+/** Returns the number of free pages in the kernel pool.  The count
+   may be stale by the time the caller looks at it. */
+size_t
+palloc_kernel_free_cnt (void)
+{
+  return kernel_pool.free_cnt;
+}
+
+/** Returns the index of PAGE within the user pool, counting from
+   0, or SIZE_MAX if PAGE is not a user pool page. */
+size_t
+palloc_user_index (const void *page)
+{
+  if (!page_from_pool (&user_pool, page))
+    return SIZE_MAX;
+  return pg_no (page) - pg_no (user_pool.base);
 }
 
 /** Initializes pool P as starting at START and ending at END,
@@ -177,12 +224,13 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
+  p->free_cnt = page_cnt;
 }
 
 /** Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
-page_from_pool (const struct pool *pool, void *page) 
+page_from_pool (const struct pool *pool, const void *page) 
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
@@ -190,3 +238,13 @@ page_from_pool (const struct pool *pool, void *page)
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/** Adds DELTA, which may wrap around to subtract, to the free page
+   count of POOL. */
+static void
+add_free_cnt (struct pool *pool, size_t delta)
+{
+  enum intr_level old_level = intr_disable ();
+  pool->free_cnt += delta;
+  intr_set_level (old_level);
+}
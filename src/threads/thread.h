@@ -117,6 +117,16 @@ struct thread
     struct process *process;            /**< Corresponding Process. */
 #endif
 
+#ifdef VM
+    /* Owned by vm/frame.c. */
+    bool frames_pinned;                 /**< Frames pinned for exit. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /**< Nesting of journal operations. */
+#endif
+
     /* Owned by thread.c. */
     unsigned magic;                     /**< Detects stack overflow. */
   };
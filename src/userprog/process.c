@@ -183,6 +183,7 @@ process_create (void)
 #ifdef VM
   p->next_id = 0;
   hash_init (&p->spl_page_table, hash_spl_pe, hash_less_spl_pe, NULL);
+  list_init (&p->vm_areas);
   hash_init (&p->mmap_table, hash_mmap_file, hash_less_mmap_file, NULL);
 #endif
 
@@ -258,14 +259,11 @@ process_exit (void)
          that's been freed (and cleared). */
       /* must not do eviction when clearing page table */
 #ifdef VM
-      lock_acquire (&evict_lock);
+      frame_exit (&pcur->spl_page_table);
 #endif
       cur->pagedir = NULL;
       pagedir_activate (NULL);
       pagedir_destroy (pd);
-#ifdef VM
-      lock_release (&evict_lock);
-#endif
     }
     /* Free the resources occupied by dead childs. */
   while (!list_empty(&pcur->childs))  
@@ -371,6 +369,7 @@ free_process (struct process *p)
 #ifdef VM
   /* remove the frames occupied from frame table */
   hash_destroy (&p->spl_page_table, hash_free_spl_pe);
+  free_vmas (&p->vm_areas);
   hash_destroy (&p->mmap_table, hash_free_mmap_file);
 #endif
 
@@ -631,9 +630,11 @@ load_segment (struct file *file, off_t offset, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (offset % PGSIZE == 0);
 #ifdef VM
-  struct hash *pt = &process_current ()->spl_page_table;
-#endif
-
+  /* Add the segment as a whole to the process's VMAs.
+     Its pages are read from FILE when a page fault happens. */
+  return add_vma (PG_FILE, &process_current ()->vm_areas, file, offset,
+                  upage, read_bytes, zero_bytes, writable);
+#else
   file_seek (file, offset);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -642,14 +643,7 @@ load_segment (struct file *file, off_t offset, uint8_t *upage,
          and zero the final PAGE_ZERO_BYTES bytes. */
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
-#ifdef VM
-      enum page_type type = page_read_bytes == PGSIZE ? PG_FILE 
-                          : (page_zero_bytes == PGSIZE ? PG_ZERO : PG_MISC);
-      /* Add a page to supplementary page table.
-         Read from file when a page fault happens. */
-      add_spl_pe (type, pt, file, offset, 
-                  upage, page_read_bytes, page_zero_bytes, writable);
-#else
+
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -669,7 +663,6 @@ load_segment (struct file *file, off_t offset, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
-#endif
       
       /* Advance. */
       offset += page_read_bytes;
@@ -678,6 +671,7 @@ load_segment (struct file *file, off_t offset, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 
@@ -695,7 +689,7 @@ setup_stack (void **esp)
 
   /* Load page to allow for argument passing. */
   *esp = PHYS_BASE;
-  return load_page (((uint8_t *)PHYS_BASE) - PGSIZE, true);
+  return load_page (((uint8_t *)PHYS_BASE) - PGSIZE, true, true);
 #else
   uint8_t *kpage;
   bool success = false;
@@ -30,6 +30,7 @@ struct process {
 #ifdef VM
     int next_id;                        /**< Next Mmap Id assigned */
     struct hash spl_page_table;         /**< SPT */
+    struct list vm_areas;               /**< VMAs, in address order */
     struct hash mmap_table;             /**< The table for mmap entries */
 #endif
 
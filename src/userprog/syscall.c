@@ -25,7 +25,7 @@
 
 /* The number of parameters required for each syscall. */
 int syscall_param_num[25] = 
-{0, 1, 1, 1, 2, 1, 1, 1, 3, 3, 2, 1, 1, 2, 1, 1, 1, 2, 1, 1};
+{0, 1, 1, 1, 2, 1, 1, 1, 3, 3, 2, 1, 1, 2, 1, 1, 1, 2, 1, 1, 1, 1, 2, 2, 1};
 
 static void syscall_handler (struct intr_frame *);
 
@@ -51,13 +51,18 @@ static bool mkdir (const char *);
 static bool readdir (int, char *);
 static bool isdir (int);
 static int inumber (int);
+static int fsync (int);
+static int fdatasync (int);
+static bool clone (const char *, const char *);
+static bool create_compressed (const char *, unsigned);
+static int disksize (int);
 
 static struct opened_file* get_opened_file_by_fd (int);
 static void check_ptr_validity (const void*);
 static void check_mem_validity (const void*, size_t);
 static void check_str_validity (const char*);
 #ifdef VM
-static bool try_load_page (const void*);
+static bool try_load_page (const void*, bool);
 static bool is_seg_writable (const void*, unsigned);
 static void reset_evictability (const void*, unsigned);
 #endif
@@ -120,6 +125,16 @@ syscall_handler (struct intr_frame *f UNUSED)
       break;
     case SYS_ISDIR: f->eax = isdir (*(int*)args[0]); break;
     case SYS_INUMBER: f->eax = inumber (*(int*)args[0]); break;
+    case SYS_FSYNC: f->eax = fsync (*(int*)args[0]); break;
+    case SYS_FDATASYNC: f->eax = fdatasync (*(int*)args[0]); break;
+    case SYS_CLONE: 
+      f->eax = clone (*(const char**)args[0], *(const char**)args[1]);
+      break;
+    case SYS_CREATE_COMPRESSED: 
+      f->eax = create_compressed (*(const char**)args[0], 
+                                  *(unsigned*)args[1]);
+      break;
+    case SYS_DISKSIZE: f->eax = disksize (*(int*)args[0]); break;
     default: NOT_REACHED ();
   }
 }
@@ -222,7 +237,8 @@ read (int fd, void *buffer, unsigned size)
 {
 #ifdef VM
   /* Install pages automatically */
-  if (!try_load_multiple (buffer, size) || !is_seg_writable (buffer, size))
+  if (!try_load_multiple (buffer, size, true)
+      || !is_seg_writable (buffer, size))
     exit (-1);
 #else
   check_mem_validity (buffer, size);
@@ -260,7 +276,7 @@ write (int fd, const void *buffer, unsigned size)
 {
 #ifdef VM
   /* Install pages automatically */
-  if (!try_load_multiple (buffer, size))
+  if (!try_load_multiple (buffer, size, false))
     exit (-1);
 #else
   check_mem_validity (buffer, size);
@@ -457,6 +473,48 @@ static int inumber (int fd)
   return inumber;
 }
 
+/** Writes the data and metadata of the file open as fd to disk.
+ *  Returns 0 once they are durable. */
+static int fsync (int fd)
+{
+  struct inode *inode = file_get_inode (get_opened_file_by_fd (fd)->file);
+  inode_sync (inode, false);
+  return 0;
+}
+
+/** Like fsync, but skips metadata not needed to read the data back. */
+static int fdatasync (int fd)
+{
+  struct inode *inode = file_get_inode (get_opened_file_by_fd (fd)->file);
+  inode_sync (inode, true);
+  return 0;
+}
+
+/** Creates file dst as a copy-on-write clone of file src. */
+static bool clone (const char *src, const char *dst)
+{
+  check_str_validity (src);
+  check_str_validity (dst);
+  return filesys_clone (src, dst);
+}
+
+/** Creates a compressed file with the given file name. */
+static bool
+create_compressed (const char *file, unsigned initial_size)
+{
+  check_str_validity (file);
+  return filesys_create_compressed (file, initial_size);
+}
+
+/** Get the number of bytes of disk space used by an opened file's
+ *  data, which is less than its size if it is compressed. */
+static int 
+disksize (int fd)
+{
+  struct opened_file* file = get_opened_file_by_fd (fd);
+  return inode_disk_length (file_get_inode (file->file));
+}
+
 /** Get opened files by its fd in current process. */
 static struct opened_file* 
 get_opened_file_by_fd (int fd)
@@ -481,30 +539,28 @@ get_opened_file_by_fd (int fd)
 }
 
 #ifdef VM
-/* Attempt to load multiple pages */
-bool try_load_multiple (const void *upage, unsigned size)
+/* Attempt to load multiple pages, for the kernel to WRITE to if
+   set */
+bool try_load_multiple (const void *upage, unsigned size, bool write)
 {
   if (size == 0)
     return true;
   for (unsigned tmp = 0; tmp < size / PGSIZE; tmp++)
-    if (!try_load_page (upage + tmp * PGSIZE))
+    if (!try_load_page (upage + tmp * PGSIZE, write))
       return false;
-  return try_load_page (upage + size);
+  return try_load_page (upage + size, write);
 }
 
 /* Try to load a user page, returns success.
    Returns true if already present */
-static bool try_load_page (const void *upage)
+static bool try_load_page (const void *upage, bool write)
 {
   if (upage == NULL || !is_user_vaddr (upage))
     return false;
-  if (pagedir_get_page (thread_current ()->pagedir, upage) != NULL)
-  {
-    set_unevictable (pagedir_get_page (thread_current()->pagedir, upage));
+  if (set_unevictable (upage))
     return true;
-  }
-  /* page not present */
-  return load_page (pg_round_down (upage), false);
+  /* page not present, or the zero page */
+  return load_page (pg_round_down (upage), write, false);
 }
 
 /* Check writability of a segment from supplementary page table. */
@@ -519,7 +575,7 @@ static bool is_seg_writable (const void *upage, unsigned size)
 static void reset_evictability (const void *buffer, unsigned size)
 {
   for (unsigned tmp = 0; tmp <= size / PGSIZE; tmp++)
-    set_evictable (pg_round_down (buffer + tmp * PGSIZE));   
-  set_evictable (pg_round_down (buffer + size));   
+    set_evictable (buffer + tmp * PGSIZE);
+  set_evictable (buffer + size);
 }
 #endif
\ No newline at end of file
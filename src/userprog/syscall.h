@@ -15,7 +15,7 @@ struct opened_file {
 void syscall_init (void);
 struct lock file_lock;
 #ifdef VM
-bool try_load_multiple (const void*, unsigned);
+bool try_load_multiple (const void*, unsigned, bool);
 #endif
 
 #endif /**< userprog/syscall.h */
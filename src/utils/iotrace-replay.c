@@ -0,0 +1,574 @@
+/* Reads a block I/O trace dumped by a Pintos kernel run with
+   -iotrace, summarizes it, and replays it against simulated
+   buffer caches and I/O schedulers. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../devices/iotrace.h"
+
+#define SECTOR_SIZE 512
+
+/* Names of the device types, in enum block_type order. */
+static const char *type_names[] =
+  {"kernel", "filesys", "scratch", "swap", "raw", "foreign"};
+#define TYPE_CNT (sizeof type_names / sizeof *type_names)
+
+static const char *program_name;
+
+static struct iotrace_header header;
+static struct iotrace_record *recs;
+static size_t rec_cnt;
+
+static void
+usage (void)
+{
+  fprintf (stderr,
+           "iotrace-replay: analyzes a Pintos block I/O trace\n"
+           "usage: %s [-c SECTORS] [-q DEPTH] FILE\n"
+           "  where FILE is a scratch disk holding a trace dumped with\n"
+           "    -iotrace=scratch, or a console log of a run with -iotrace,\n"
+           "  -c SECTORS is the largest buffer cache to simulate\n"
+           "    (default 1024), and\n"
+           "  -q DEPTH is the queue depth for scheduler replay (default 8).\n",
+           program_name);
+  exit (EXIT_FAILURE);
+}
+
+static void
+fail (const char *message, const char *file)
+{
+  fprintf (stderr, "%s: %s: %s\n", program_name, file, message);
+  exit (EXIT_FAILURE);
+}
+
+static void *
+xmalloc (size_t size)
+{
+  void *p = calloc (1, size > 0 ? size : 1);
+  if (p == NULL)
+    {
+      fprintf (stderr, "%s: out of memory\n", program_name);
+      exit (EXIT_FAILURE);
+    }
+  return p;
+}
+
+/* Returns the name of device type TYPE. */
+static const char *
+type_name (unsigned type)
+{
+  return type < TYPE_CNT ? type_names[type] : "?";
+}
+
+/* Reads all of FILE into a new buffer, storing its size in
+   *SIZE. */
+static uint8_t *
+read_file (const char *file, size_t *size)
+{
+  FILE *f = fopen (file, "rb");
+  uint8_t *data = NULL;
+  size_t cap = 0;
+
+  if (f == NULL)
+    fail (strerror (errno), file);
+  *size = 0;
+  for (;;)
+    {
+      size_t n;
+      if (*size == cap)
+        {
+          cap = cap ? cap * 2 : 1 << 20;
+          data = realloc (data, cap);
+          if (data == NULL)
+            fail ("out of memory", file);
+        }
+      n = fread (data + *size, 1, cap - *size, f);
+      if (n == 0)
+        break;
+      *size += n;
+    }
+  if (ferror (f))
+    fail (strerror (errno), file);
+  fclose (f);
+  return data;
+}
+
+/* Extracts the bytes printed in hexadecimal on the lines of the
+   console log in DATA[0...SIZE) that begin with IOTRACE_PREFIX,
+   replacing DATA's contents.  Returns the number of bytes. */
+static size_t
+parse_log (uint8_t *data, size_t size)
+{
+  const size_t prefix_len = strlen (IOTRACE_PREFIX);
+  size_t in = 0, out = 0;
+
+  while (in < size)
+    {
+      size_t end = in;
+      while (end < size && data[end] != '\n')
+        end++;
+      if (end - in > prefix_len
+          && !memcmp (data + in, IOTRACE_PREFIX, prefix_len))
+        {
+          size_t i;
+          for (i = in + prefix_len; i + 1 < end; i += 2)
+            {
+              unsigned byte;
+              char hex[3] = {data[i], data[i + 1], '\0'};
+              if (sscanf (hex, "%2x", &byte) != 1)
+                break;
+              data[out++] = byte;
+            }
+        }
+      in = end + 1;
+    }
+  return out;
+}
+
+/* Finds a dump in FILE and loads it into HEADER and RECS. */
+static void
+load_trace (const char *file)
+{
+  size_t size, ofs;
+  uint8_t *data = read_file (file, &size);
+
+  if (size < sizeof IOTRACE_MAGIC - 1
+      || memcmp (data, IOTRACE_MAGIC, sizeof IOTRACE_MAGIC - 1))
+    {
+      /* Disk images may hold the scratch partition anywhere, so
+         look for the header at each sector boundary.  If there is
+         none, try FILE as a console log. */
+      for (ofs = 0; ofs + SECTOR_SIZE <= size; ofs += SECTOR_SIZE)
+        if (!memcmp (data + ofs, IOTRACE_MAGIC, sizeof IOTRACE_MAGIC - 1))
+          break;
+      if (ofs + SECTOR_SIZE > size)
+        {
+          size = parse_log (data, size);
+          ofs = 0;
+        }
+    }
+  else
+    ofs = 0;
+
+  if (size - ofs < IOTRACE_HEADER_SIZE
+      || memcmp (data + ofs, IOTRACE_MAGIC, sizeof IOTRACE_MAGIC - 1))
+    fail ("no I/O trace found", file);
+  memcpy (&header, data + ofs, sizeof header);
+  if (header.version != IOTRACE_VERSION)
+    fail ("unsupported trace version", file);
+  if (header.dev_cnt > IOTRACE_DEVS)
+    fail ("corrupt trace header", file);
+
+  ofs += IOTRACE_HEADER_SIZE;
+  rec_cnt = header.rec_cnt;
+  if ((size - ofs) / sizeof *recs < rec_cnt)
+    {
+      fprintf (stderr, "%s: %s: trace truncated to %zu of %zu records\n",
+               program_name, file, (size - ofs) / sizeof *recs, rec_cnt);
+      rec_cnt = (size - ofs) / sizeof *recs;
+    }
+  recs = xmalloc (rec_cnt * sizeof *recs);
+  memcpy (recs, data + ofs, rec_cnt * sizeof *recs);
+  free (data);
+}
+
+static uint64_t
+rec_time (const struct iotrace_record *r)
+{
+  return (uint64_t) r->time_hi << 32 | r->time_lo;
+}
+
+static unsigned
+rec_role (const struct iotrace_record *r)
+{
+  return (r->flags & IOTRACE_ROLE_MASK) >> IOTRACE_ROLE_SHIFT;
+}
+
+static bool
+rec_write (const struct iotrace_record *r)
+{
+  return r->flags & IOTRACE_WRITE;
+}
+
+static uint64_t
+distance (uint32_t a, uint32_t b)
+{
+  return a > b ? a - b : b - a;
+}
+
+/* Prints the trace's overall shape and, for each device, its
+   request mix, where the requests came from, and how local they
+   are in the order they were submitted. */
+static void
+print_summary (void)
+{
+  uint64_t span = rec_cnt > 0 ? rec_time (&recs[rec_cnt - 1]) : 0;
+  unsigned dev;
+
+  printf ("%zu requests", rec_cnt);
+  if (header.lost > 0)
+    printf (" (%llu older ones lost)", (unsigned long long) header.lost);
+  if (header.cycles_per_us > 0)
+    printf (" over %.3f s", (double) span / header.cycles_per_us / 1e6);
+  printf ("\n\n");
+
+  for (dev = 0; dev < header.dev_cnt; dev++)
+    {
+      const struct iotrace_device *d = &header.devs[dev];
+      uint64_t reqs[2] = {0, 0}, sectors[2] = {0, 0};
+      uint64_t role_sectors[TYPE_CNT] = {0};
+      uint64_t seq = 0, seek = 0, touched = 0, distinct = 0, moves = 0;
+      uint8_t *seen = xmalloc ((d->size + 7) / 8);
+      bool have_head = false;
+      uint32_t head = 0;
+      size_t i;
+      unsigned t;
+
+      for (i = 0; i < rec_cnt; i++)
+        {
+          const struct iotrace_record *r = &recs[i];
+          uint32_t s;
+
+          if (r->dev != dev)
+            continue;
+          reqs[rec_write (r)]++;
+          sectors[rec_write (r)] += r->cnt;
+          if (rec_role (r) < TYPE_CNT)
+            role_sectors[rec_role (r)] += r->cnt;
+
+          if (have_head)
+            {
+              moves++;
+              if (r->sector == head)
+                seq++;
+              seek += distance (r->sector, head);
+            }
+          have_head = true;
+          head = r->sector + r->cnt;
+
+          for (s = r->sector; s < r->sector + r->cnt && s < d->size; s++)
+            {
+              touched++;
+              if (!(seen[s / 8] & (1 << s % 8)))
+                {
+                  seen[s / 8] |= 1 << s % 8;
+                  distinct++;
+                }
+            }
+        }
+      free (seen);
+      if (reqs[0] + reqs[1] == 0)
+        continue;
+
+      printf ("%s (%s, %u sectors):\n", d->name, type_name (d->type), d->size);
+      printf ("  %llu reads of %llu sectors, %llu writes of %llu sectors\n",
+              (unsigned long long) reqs[0], (unsigned long long) sectors[0],
+              (unsigned long long) reqs[1], (unsigned long long) sectors[1]);
+      printf ("  from:");
+      for (t = 0; t < TYPE_CNT; t++)
+        if (role_sectors[t] > 0)
+          printf (" %s %llu", type_names[t],
+                  (unsigned long long) role_sectors[t]);
+      printf (" sectors\n");
+      if (moves > 0)
+        printf ("  %.1f%% sequential, mean seek %.1f sectors\n",
+                100.0 * seq / moves, (double) seek / moves);
+      if (touched > 0)
+        printf ("  footprint %llu sectors, %.1f%% of sectors touched again\n",
+                (unsigned long long) distinct,
+                100.0 * (touched - distinct) / touched);
+    }
+}
+
+/* A simulated buffer cache of sectors, replacing either the least
+   recently used sector or, as filesys/cache.c does, the first one
+   the clock hand finds unaccessed. */
+struct sim_cache
+  {
+    bool clock;                 /* Clock rather than LRU. */
+    size_t size;                /* Number of slots. */
+    size_t used;                /* Number of slots filled. */
+    uint64_t *keys;             /* Device and sector in each slot. */
+    uint64_t *stamps;           /* LRU: time of last use. */
+    bool *accessed;             /* Clock: used since the hand passed. */
+    size_t hand;                /* Clock hand. */
+    size_t *next;               /* Next slot in the same bucket. */
+    size_t *buckets;            /* First slot with each hash, or SIZE. */
+    size_t bucket_cnt;
+  };
+
+static size_t
+bucket_of (const struct sim_cache *c, uint64_t key)
+{
+  return (key * 0x9e3779b97f4a7c15ULL >> 32) & (c->bucket_cnt - 1);
+}
+
+static void
+cache_init (struct sim_cache *c, size_t size, bool clock)
+{
+  size_t i;
+
+  c->clock = clock;
+  c->size = size;
+  c->used = 0;
+  c->hand = 0;
+  c->keys = xmalloc (size * sizeof *c->keys);
+  c->stamps = xmalloc (size * sizeof *c->stamps);
+  c->accessed = xmalloc (size * sizeof *c->accessed);
+  c->next = xmalloc (size * sizeof *c->next);
+  for (c->bucket_cnt = 1; c->bucket_cnt < size * 2; c->bucket_cnt *= 2)
+    continue;
+  c->buckets = xmalloc (c->bucket_cnt * sizeof *c->buckets);
+  for (i = 0; i < c->bucket_cnt; i++)
+    c->buckets[i] = size;
+}
+
+static void
+cache_destroy (struct sim_cache *c)
+{
+  free (c->keys);
+  free (c->stamps);
+  free (c->accessed);
+  free (c->next);
+  free (c->buckets);
+}
+
+/* Picks a slot to replace. */
+static size_t
+cache_victim (struct sim_cache *c)
+{
+  size_t i, victim = 0;
+
+  if (c->used < c->size)
+    return c->used++;
+  if (c->clock)
+    {
+      while (c->accessed[c->hand])
+        {
+          c->accessed[c->hand] = false;
+          c->hand = (c->hand + 1) % c->size;
+        }
+      victim = c->hand;
+      c->hand = (c->hand + 1) % c->size;
+    }
+  else
+    for (i = 1; i < c->size; i++)
+      if (c->stamps[i] < c->stamps[victim])
+        victim = i;
+
+  /* Unlink it from its bucket. */
+  {
+    size_t *p = &c->buckets[bucket_of (c, c->keys[victim])];
+    while (*p != victim)
+      p = &c->next[*p];
+    *p = c->next[victim];
+  }
+  return victim;
+}
+
+/* Accesses KEY at time NOW.  Returns true on a hit. */
+static bool
+cache_access (struct sim_cache *c, uint64_t key, uint64_t now)
+{
+  size_t b = bucket_of (c, key);
+  size_t i;
+
+  for (i = c->buckets[b]; i < c->size; i = c->next[i])
+    if (c->keys[i] == key)
+      {
+        c->stamps[i] = now;
+        c->accessed[i] = true;
+        return true;
+      }
+
+  i = cache_victim (c);
+  c->keys[i] = key;
+  c->stamps[i] = now;
+  c->accessed[i] = true;
+  c->next[i] = c->buckets[b];
+  c->buckets[b] = i;
+  return false;
+}
+
+/* Replays every sector of the trace through LRU and clock caches
+   of 16 sectors up to MAX_SIZE sectors.  Every sector in the trace
+   missed the kernel's own cache (or was written back from it), so
+   the hit rates estimate how much of that traffic a cache of each
+   size and policy would have absorbed. */
+static void
+print_cache_replay (size_t max_size)
+{
+  size_t size;
+
+  printf ("\nbuffer cache replay (hits among all sectors / read sectors):\n");
+  printf ("  %8s %18s %18s\n", "sectors", "LRU", "clock");
+  for (size = 16; size <= max_size; size *= 2)
+    {
+      int policy;
+
+      printf ("  %8zu", size);
+      for (policy = 0; policy < 2; policy++)
+        {
+          struct sim_cache c;
+          uint64_t now = 0, hits = 0, total = 0, read_hits = 0, reads = 0;
+          size_t i;
+
+          cache_init (&c, size, policy == 1);
+          for (i = 0; i < rec_cnt; i++)
+            {
+              const struct iotrace_record *r = &recs[i];
+              uint32_t s;
+              for (s = r->sector; s < r->sector + r->cnt; s++)
+                {
+                  bool hit = cache_access (&c, (uint64_t) r->dev << 32 | s,
+                                           now++);
+                  hits += hit;
+                  total++;
+                  if (!rec_write (r))
+                    {
+                      read_hits += hit;
+                      reads++;
+                    }
+                }
+            }
+          cache_destroy (&c);
+          printf ("   %6.1f%% %6.1f%%",
+                  total ? 100.0 * hits / total : 0.0,
+                  reads ? 100.0 * read_hits / reads : 0.0);
+        }
+      printf ("\n");
+    }
+}
+
+/* I/O schedulers, as in devices/iosched.c. */
+enum sched
+  {
+    SCHED_FIFO,                 /* Submission order. */
+    SCHED_CLOOK,                /* Ascending sector order, wrapping. */
+    SCHED_SSTF,                 /* Nearest to the head. */
+    SCHED_CNT
+  };
+
+static const char *sched_names[SCHED_CNT] = {"fifo", "clook", "sstf"};
+
+/* Returns the index in QUEUE[0...CNT) of the request SCHED serves
+   next when the head is at HEAD. */
+static size_t
+sched_pick (enum sched sched, const struct iotrace_record **queue,
+            size_t cnt, uint32_t head)
+{
+  size_t i, best = 0;
+
+  for (i = 1; i < cnt; i++)
+    {
+      uint32_t s = queue[i]->sector, b = queue[best]->sector;
+      switch (sched)
+        {
+        case SCHED_FIFO:
+          return 0;
+        case SCHED_CLOOK:
+          /* Smallest sector at or past HEAD, else smallest. */
+          if ((s >= head) != (b >= head) ? s >= head : s < b)
+            best = i;
+          break;
+        case SCHED_SSTF:
+          if (distance (s, head) < distance (b, head))
+            best = i;
+          break;
+        default:
+          abort ();
+        }
+    }
+  return best;
+}
+
+/* Replays each device's requests through each scheduler with
+   DEPTH requests kept queued, and prints the total head movement.
+   Keeping the queue full is an upper bound on what reordering can
+   gain, since the real queue is often shallower. */
+static void
+print_sched_replay (size_t depth)
+{
+  const struct iotrace_record **queue = xmalloc (depth * sizeof *queue);
+  unsigned dev;
+  int sched;
+
+  printf ("\nscheduler replay at queue depth %zu (mean seek in sectors):\n",
+          depth);
+  printf ("  %-16s", "device");
+  for (sched = 0; sched < SCHED_CNT; sched++)
+    printf (" %12s", sched_names[sched]);
+  printf ("\n");
+
+  for (dev = 0; dev < header.dev_cnt; dev++)
+    {
+      bool any = false;
+
+      for (sched = 0; sched < SCHED_CNT; sched++)
+        {
+          uint64_t seek = 0, served = 0;
+          uint32_t head = 0;
+          size_t next = 0, cnt = 0;
+
+          for (;;)
+            {
+              size_t pick;
+
+              for (; cnt < depth && next < rec_cnt; next++)
+                if (recs[next].dev == dev)
+                  queue[cnt++] = &recs[next];
+              if (cnt == 0)
+                break;
+
+              pick = sched_pick (sched, queue, cnt, head);
+              if (served++ > 0)
+                seek += distance (queue[pick]->sector, head);
+              head = queue[pick]->sector + queue[pick]->cnt;
+              cnt--;
+              memmove (&queue[pick], &queue[pick + 1],
+                       (cnt - pick) * sizeof *queue);
+            }
+          if (served < 2)
+            break;
+          if (!any)
+            printf ("  %-16s", header.devs[dev].name);
+          any = true;
+          printf (" %12.1f", (double) seek / (served - 1));
+        }
+      if (any)
+        printf ("\n");
+    }
+  free (queue);
+}
+
+int
+main (int argc, char *argv[])
+{
+  size_t max_cache = 1024, depth = 8;
+  int i;
+
+  program_name = argv[0];
+  for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+      if (i + 1 >= argc)
+        usage ();
+      if (!strcmp (argv[i], "-c"))
+        max_cache = strtoul (argv[++i], NULL, 10);
+      else if (!strcmp (argv[i], "-q"))
+        depth = strtoul (argv[++i], NULL, 10);
+      else
+        usage ();
+    }
+  if (i + 1 != argc || depth == 0)
+    usage ();
+
+  load_trace (argv[i]);
+  print_summary ();
+  print_cache_replay (max_cache);
+  print_sched_replay (depth);
+  return EXIT_SUCCESS;
+}
@@ -1,79 +1,304 @@
 #include "vm/frame.h"
-#include <list.h>
 #include <bitmap.h>
-#include "threads/malloc.h"
+#include <round.h>
+#include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/synch.h"
 #include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "filesys/file.h"
 #include "userprog/process.h"
 #include "userprog/pagedir.h"
 #include "vm/page.h"
 #include "vm/swap.h"
 
-static struct list frame_table;
-static struct lock ft_lock;
-static struct list_elem *evict_pt;
-static struct list_elem* next_frame (struct list_elem*);
-static struct list_elem* prev_frame (struct list_elem*);
-static bool evict (struct frame*, struct spl_pe*, bool);
-static struct frame* get_frame_to_evict (void);
-static struct frame* add_frame (void*, struct spl_pe*, bool);
-static struct frame* find_frame (void*);
+/* One entry per user pool page, indexed by palloc_user_index().
+   Entry states and the clock hand only change with interrupts off,
+   in short sections that never sleep, so faults in different
+   processes do not queue on a table lock.  A BUSY frame belongs to
+   the one thread loading or evicting it, which does its I/O with
+   nothing locked. */
+static struct frame *frame_table;
+static size_t frame_cnt;
+static size_t clock_hand;
+
+/* Threads in get_frame() waiting, because every frame was busy or
+   pinned, for one to be freed or become evictable.  FRAME_GEN
+   counts those events, so that none is missed between a failed
+   scan and the wait. */
+static struct lock frame_wait_lock;
+static struct condition frame_released;
+static unsigned frame_gen;
+static size_t frame_waiters;
+
+/* Waiting for the evicting bit of a page to clear */
+static struct lock evict_wait_lock;
+static struct condition evict_done;
+
+/* Shared frames by file and offset, and waiting for one that is
+   busy to be loaded, joined or evicted. */
+static struct hash share_table;
+static struct lock share_lock;
+static struct condition share_ready;
+
+/* The page-out daemon is woken when fewer than low_water user pages
+   are free and evicts pages until high_water are free again, so
+   that most faults find a free page instead of evicting one. */
+static size_t low_water, high_water;
+static struct semaphore pageout_sema;
+static bool pageout_pending;    /* Woken and not yet done */
+
+static void pageout_daemon (void*);
+static size_t pageout_batch (void);
+static void sort_batch (struct frame**, bool*, size_t);
+static bool batch_before (const struct frame*, const struct frame*);
+static bool unmap_frame (struct frame*);
+static bool needs_swap (const struct spl_pe*, bool);
+static void discard_slot (struct spl_pe*);
+static size_t swap_cache_reclaim (void);
+static bool page_out (struct frame*, bool);
+static void remap_frame (struct frame*, bool);
+static void restore_frame (struct frame*);
+static void wake_frame_waiters (void);
+static void end_eviction (struct spl_pe*);
+static struct frame* get_frame_to_evict (bool*);
+static struct frame* add_frame (void*, struct spl_pe*);
+static struct frame* find_frame (const void*);
+static bool claim_shared (struct frame*);
+static void drop_shared (struct frame*);
+static void leave_shared (struct spl_pe*);
+static unsigned hash_share (const struct hash_elem*, void*);
+static bool hash_less_share (const struct hash_elem*,
+                             const struct hash_elem*, void*);
 
 void frame_table_init (void)
 {
-    evict_pt = NULL;
-    lock_init (&ft_lock);
-    list_init (&frame_table);
-    lock_init (&evict_lock);
+    frame_cnt = palloc_user_page_cnt ();
+    frame_table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                        DIV_ROUND_UP (frame_cnt * sizeof *frame_table, PGSIZE));
+    for (size_t i = 0; i < frame_cnt; i++)
+    {
+        frame_table[i].state = FRAME_FREE;
+        list_init (&frame_table[i].sharers);
+    }
+    clock_hand = 0;
+    lock_init (&frame_wait_lock);
+    cond_init (&frame_released);
+    frame_gen = 0;
+    frame_waiters = 0;
+    lock_init (&evict_wait_lock);
+    cond_init (&evict_done);
+    hash_init (&share_table, hash_share, hash_less_share, NULL);
+    lock_init (&share_lock);
+    cond_init (&share_ready);
+
+    low_water = frame_cnt / 32 > 2 ? frame_cnt / 32 : 2;
+    high_water = 2 * low_water;
+    sema_init (&pageout_sema, 0);
+    pageout_pending = false;
+    thread_create ("pageout", PRI_DEFAULT, pageout_daemon, NULL);
 }
 
 /**
- * Get a frame from physical memory.
+ * Get a frame from physical memory for PE, returned busy.
  * Automatically evict one if no space left.
  */
-struct frame* get_frame (struct spl_pe *pe, bool evictable)
+struct frame* get_frame (struct spl_pe *pe)
 {
     void *ret = palloc_get_page (PAL_USER);
     if (ret != NULL)
-        return add_frame (ret, pe, evictable);      
-    
+        return add_frame (ret, pe);
+
+    /* Evict one, waiting whenever everything is busy or pinned */
     struct frame *fe = NULL;
-    lock_acquire (&evict_lock);
+    bool dirty;
+    lock_acquire (&frame_wait_lock);
+    frame_waiters++;
+    for (;;)
     {
-        lock_acquire (&ft_lock);
+        unsigned gen = frame_gen;
+        lock_release (&frame_wait_lock);
+        if ((ret = palloc_get_page (PAL_USER)) != NULL
+            || (fe = get_frame_to_evict (&dirty)) != NULL)
+            break;
+        lock_acquire (&frame_wait_lock);
+        while (frame_gen == gen)
+            cond_wait (&frame_released, &frame_wait_lock);
+    }
+    lock_acquire (&frame_wait_lock);
+    frame_waiters--;
+    lock_release (&frame_wait_lock);
+    if (ret != NULL)
+        return add_frame (ret, pe);
+
+    /* A shared victim is clean and has no SPE of its own */
+    struct spl_pe *prev_pe = fe->spl_pe;
+    if (fe->shared)
+        drop_shared (fe);
+    else if (!page_out (fe, dirty))
+    {
+        remap_frame (fe, dirty);
+        restore_frame (fe);
+        end_eviction (prev_pe);
+        return NULL;
+    }
+
+    // Change frame entry
+    fe->thread = thread_current ();
+    fe->spl_pe = pe;
+    fe->tid = thread_current ()->tid;
+    if (prev_pe != NULL)
+        end_eviction (prev_pe);
+    return fe;
+}
+
+/**
+ * Get the frame for page PE, which is_shareable(), returned busy.
+ * If a process running the same executable has the page in memory,
+ * *LOADED is set and its frame is returned, to be mapped as well;
+ * otherwise the frame is new and must be loaded.
+ */
+struct frame* get_shared_frame (struct spl_pe *pe, bool *loaded)
+{
+    struct frame key;
+    key.inode = file_get_inode (pe->file);
+    key.offset = pe->offset;
+    key.read_bytes = pe->read_bytes;
+
+    struct frame *fe = NULL;
+    lock_acquire (&share_lock);
+    for (;;)
+    {
+        struct hash_elem *e = hash_find (&share_table, &key.share_elem);
+        if (e != NULL)
         {
-            ASSERT (!list_empty (&frame_table));
-            fe = get_frame_to_evict ();
-            /* If eviction successful */
-            if (!evict (fe, pe, evictable))
-                fe = NULL;
+            struct frame *sf = hash_entry (e, struct frame, share_elem);
+            /* Join it, unless it is being loaded, joined or evicted */
+            enum intr_level old_level = intr_disable ();
+            bool join = sf->state == FRAME_MAPPED;
+            if (join)
+            {
+                sf->state = FRAME_BUSY;
+                sf->spl_pe = pe;
+            }
+            intr_set_level (old_level);
+            if (join)
+            {
+                lock_release (&share_lock);
+                if (fe != NULL)
+                    palloc_free_page (fe->frame);
+                *loaded = true;
+                return sf;
+            }
+            cond_wait (&share_ready, &share_lock);
+        }
+        else if (fe != NULL)
+            break;
+        else
+        {
+            /* Eviction may need share_lock */
+            lock_release (&share_lock);
+            fe = get_frame (pe);
+            if (fe == NULL)
+                return NULL;
+            lock_acquire (&share_lock);
         }
-        lock_release (&ft_lock);
     }
-    lock_release (&evict_lock);
+
+    fe->shared = true;
+    fe->inode = key.inode;
+    fe->offset = key.offset;
+    fe->read_bytes = key.read_bytes;
+    hash_insert (&share_table, &fe->share_elem);
+    lock_release (&share_lock);
+    *loaded = false;
     return fe;
 }
 
-/** 
- * Add frame entry into frame table. 
- * Synchronization secure.
+/**
+ * Give up frame F, got for loading a page that could not be mapped.
+ * A shared frame other processes map is only left to them.
+ */
+void abandon_frame (struct frame *f)
+{
+    ASSERT (f->state == FRAME_BUSY);
+    if (f->shared && !list_empty (&f->sharers))
+    {
+        lock_acquire (&share_lock);
+        f->spl_pe = NULL;
+        f->state = FRAME_MAPPED;
+        cond_broadcast (&share_ready, &share_lock);
+        lock_release (&share_lock);
+        wake_frame_waiters ();
+    }
+    else
+        palloc_free_page (f->frame);
+}
+
+/**
+ * Get a free frame for PE, returned busy, without evicting.
+ * Returns NULL if there is none.
+ */
+struct frame* try_get_frame (struct spl_pe *pe)
+{
+    void *ret = palloc_get_page (PAL_USER);
+    return ret != NULL ? add_frame (ret, pe) : NULL;
+}
+
+/**
+ * Hand frame F, loaded and mapped by its owner, over to the clock,
+ * or pin it down unless EVICTABLE.
+ */
+void release_frame (struct frame *f, bool evictable)
+{
+    ASSERT (f->state == FRAME_BUSY);
+    if (!f->shared)
+    {
+        ASSERT (f->thread == thread_current ());
+        f->state = evictable ? FRAME_MAPPED : FRAME_PINNED;
+        if (evictable)
+            wake_frame_waiters ();
+        return;
+    }
+
+    /* A shared frame is pinned by each of its sharers on its own */
+    struct spl_pe *pe = f->spl_pe;
+    lock_acquire (&share_lock);
+    pe->thread = thread_current ();
+    pe->pinned = !evictable;
+    enum intr_level old_level = intr_disable ();
+    list_push_back (&f->sharers, &pe->share_elem);
+    f->spl_pe = NULL;
+    f->state = FRAME_MAPPED;
+    intr_set_level (old_level);
+    cond_broadcast (&share_ready, &share_lock);
+    lock_release (&share_lock);
+    if (evictable)
+        wake_frame_waiters ();
+}
+
+/**
+ * Add frame entry into frame table, busy for the current thread.
 */
 static struct frame*
-add_frame (void *frame, struct spl_pe *pe, bool evictable)
+add_frame (void *frame, struct spl_pe *pe)
 {
-    struct frame *f = malloc (sizeof (struct frame));
+    struct frame *f = find_frame (frame);
+    ASSERT (f != NULL);
+
+    enum intr_level old_level = intr_disable ();
+    ASSERT (f->state == FRAME_FREE);
     f->frame = frame;
     f->spl_pe = pe;
     f->tid = thread_current ()->tid;
     f->thread = thread_current ();
-    f->evictable = evictable;
-    lock_init (&f->frame_lock);
-    
-    lock_acquire (&ft_lock);
-    lock_acquire (&f->frame_lock);
-    list_push_back (&frame_table, &f->elem);
-    lock_release (&ft_lock);
+    f->state = FRAME_BUSY;
+    bool wake = !pageout_pending && palloc_user_free_cnt () < low_water;
+    if (wake)
+        pageout_pending = true;
+    intr_set_level (old_level);
+    if (wake)
+        sema_up (&pageout_sema);
     return f;
 }
 
@@ -82,150 +307,588 @@ add_frame (void *frame, struct spl_pe *pe, bool evictable)
  */
 void remove_frame (void *frame)
 {
-    struct list_elem *e;
-    
-    lock_acquire (&ft_lock);
-    for (e = list_begin (&frame_table); e != list_end (&frame_table);
-        e = list_next (e))
-    {
-        struct frame *f = list_entry (e, struct frame, elem);
-        if (f->frame == frame)
-        {
-            list_remove (e);
-            /* move back eviction pointer if the frame it is
-               pointing to is going to be removed */
-            if (e == evict_pt)
-                evict_pt = prev_frame (evict_pt);
-            free (f);
-            lock_release (&ft_lock);
-            return ;
-        }
-    }
-    lock_release (&ft_lock);
-    PANIC ("vm_remove_fe: user frame not found in frame table");
+    struct frame *f = find_frame (frame);
+    if (f != NULL && f->shared)
+        drop_shared (f);
+    enum intr_level old_level = intr_disable ();
+    if (f == NULL || f->state == FRAME_FREE)
+        PANIC ("vm_remove_fe: user frame not found in frame table");
+    f->state = FRAME_FREE;
+    f->spl_pe = NULL;
+    f->thread = NULL;
+    intr_set_level (old_level);
 }
 
-static struct frame* get_frame_to_evict (void)
+/**
+ * Called by palloc_free_page() once a user pool page is free again.
+ */
+void frame_freed (void)
+{
+    wake_frame_waiters ();
+}
+
+/**
+ * Wake the threads waiting in get_frame(), as a frame was freed or
+ * became evictable.
+ */
+static void wake_frame_waiters (void)
+{
+    if (frame_waiters == 0)
+        return;
+    lock_acquire (&frame_wait_lock);
+    frame_gen++;
+    cond_broadcast (&frame_released, &frame_wait_lock);
+    lock_release (&frame_wait_lock);
+}
+
+/**
+ * Pick a victim with the clock algorithm, make it busy and unmap
+ * it, setting *DIRTY to whether it was dirty.  Busy and pinned
+ * frames are skipped.  Returns NULL after two sweeps of the clock
+ * without finding one.
+ */
+static struct frame* get_frame_to_evict (bool *dirty)
 {
-    uint32_t *page_table;
-    while (true)
+    for (size_t scanned = 0; scanned < 2 * frame_cnt; scanned++)
     {
-        evict_pt = next_frame (evict_pt);
-        struct frame *fe = list_entry (evict_pt, struct frame, elem);
-        lock_acquire (&fe->frame_lock);
-        page_table = fe->thread->pagedir;
-        /* Use CLOCK algorithm */
-        if (fe->evictable && 
-            !pagedir_is_accessed (page_table, fe->spl_pe->upage))
-            return fe;
-        lock_release (&fe->frame_lock);
-        pagedir_set_accessed (page_table, fe->spl_pe->upage, false);
+        enum intr_level old_level = intr_disable ();
+        struct frame *fe = frame_table + clock_hand;
+        clock_hand = (clock_hand + 1) % frame_cnt;
+        if (fe->state == FRAME_MAPPED && fe->shared)
+        {
+            if (claim_shared (fe))
+            {
+                fe->state = FRAME_BUSY;
+                *dirty = false;
+                intr_set_level (old_level);
+                return fe;
+            }
+        }
+        else if (fe->state == FRAME_MAPPED)
+        {
+            uint32_t *page_table = fe->thread->pagedir;
+            /* Use CLOCK algorithm */
+            if (!pagedir_is_accessed (page_table, fe->spl_pe->upage))
+            {
+                fe->state = FRAME_BUSY;
+                *dirty = unmap_frame (fe);
+                intr_set_level (old_level);
+                return fe;
+            }
+            pagedir_set_accessed (page_table, fe->spl_pe->upage, false);
+        }
+        intr_set_level (old_level);
     }
-    NOT_REACHED ();
+    return NULL;
 }
 
 /**
- * Swap out the given frame
- * F is the frame to evict, PE is the page entry to occupy F
- * Need to assume that ft_lock is held
+ * Unmap the page held by frame F, chosen for eviction, so that its
+ * owner can no longer modify it, and mark it evicting until
+ * end_eviction().  Returns true if it was dirty.
+ * Need to assume that interrupts are off
  */
-static bool evict (struct frame *f, struct spl_pe *pe, bool evictable)
+static bool unmap_frame (struct frame *f)
 {
     uint32_t *page_table = f->thread->pagedir;
     struct spl_pe *prev_pe = f->spl_pe;
 
-    ASSERT (pagedir_get_page (page_table, prev_pe->upage) != NULL);
+    ASSERT (intr_get_level () == INTR_OFF);
     ASSERT (pagedir_get_page (page_table, prev_pe->upage) == f->frame);
-    ASSERT (pe != NULL && f != NULL);
-    size_t slot = BITMAP_ERROR;
     bool dirty = pagedir_is_dirty (page_table, prev_pe->upage);
     /* Clear page now to avoid further modification*/
     pagedir_clear_page (page_table, prev_pe->upage);
     prev_pe->present = false;
     prev_pe->kpage = NULL;
+    prev_pe->evicting = true;
+    return dirty;
+}
 
-    /* If dirty, need swapping out */
-    if ((dirty || prev_pe->type == PG_SWAP) && (prev_pe->type != PG_MMAP)
-    /* If swapping out failed */
-    && ((slot = swap_out (f->frame)) == BITMAP_ERROR))
-        return false;
+/**
+ * Returns true if page PE, unmapped with DIRTY set as given, must
+ * be written to swap to be evicted.  A clean page swapped in earlier
+ * still has its copy in the slot it came from, unless that slot was
+ * reclaimed.
+ */
+static bool needs_swap (const struct spl_pe *pe, bool dirty)
+{
+    return pe->type != PG_MMAP 
+        && (dirty || (pe->type == PG_SWAP && pe->slot == BITMAP_ERROR));
+}
+
+/**
+ * Free the swap slot of PE, whose copy there is out of date.
+ */
+static void discard_slot (struct spl_pe *pe)
+{
+    if (pe->slot != BITMAP_ERROR)
+    {
+        swap_free (pe->slot);
+        pe->slot = BITMAP_ERROR;
+    }
+}
+
+/**
+ * Free the slots that keep swap copies of pages now in memory, as
+ * the swap device is full.  Those pages will be written out again
+ * if evicted.  Returns the number of slots freed.
+ */
+static size_t swap_cache_reclaim (void)
+{
+    size_t cnt = 0;
+    for (size_t i = 0; i < frame_cnt; i++)
+    {
+        struct frame *fe = frame_table + i;
+        size_t slot = BITMAP_ERROR;
+        /* Busy frames are being loaded or evicted by their owner */
+        enum intr_level old_level = intr_disable ();
+        if ((fe->state == FRAME_MAPPED || fe->state == FRAME_PINNED)
+            && !fe->shared && fe->spl_pe->slot != BITMAP_ERROR)
+        {
+            slot = fe->spl_pe->slot;
+            fe->spl_pe->slot = BITMAP_ERROR;
+        }
+        intr_set_level (old_level);
+        if (slot != BITMAP_ERROR)
+        {
+            swap_free (slot);
+            cnt++;
+        }
+    }
+    return cnt;
+}
 
-    if (dirty && prev_pe->type == PG_MMAP)
+/**
+ * Write out the page held by frame F, unmapped by unmap_frame(),
+ * to swap or to its file, and record where it went.
+ * DIRTY is what unmap_frame() returned for it
+ * Returns false if it could not be written
+ * F must be busy for the current thread
+ */
+static bool page_out (struct frame *f, bool dirty)
+{
+    struct spl_pe *prev_pe = f->spl_pe;
+    size_t slot = BITMAP_ERROR;
+
+    /* If dirty, need swapping out */
+    if (needs_swap (prev_pe, dirty))
     {
-        lock_acquire (&file_lock);
-        bool flag = ((unsigned) file_write_at (prev_pe->file, f->frame, 
-                                               prev_pe->read_bytes,    
-                                               prev_pe->offset)
-                     < prev_pe->read_bytes);
-        lock_release (&file_lock);
-        if (!flag)
+        discard_slot (prev_pe);
+        slot = swap_out (f->frame);
+        if (slot == BITMAP_ERROR && swap_cache_reclaim () > 0)
+            slot = swap_out (f->frame);
+        /* If swapping out failed */
+        if (slot == BITMAP_ERROR)
             return false;
     }
 
+    if (dirty && prev_pe->type == PG_MMAP
+        && ((unsigned) file_write_at (prev_pe->file, f->frame,
+                                      prev_pe->read_bytes, prev_pe->offset)
+            < prev_pe->read_bytes))
+        return false;
+
     /* Change the corresponding spl_pe */
     if (slot != BITMAP_ERROR && prev_pe->type != PG_MMAP)
     {
         prev_pe->type = PG_SWAP;
         prev_pe->slot = slot;
     }
+    return true;
+}
 
-    // Change frame entry
-    f->evictable = evictable;
-    f->thread = thread_current ();
-    f->spl_pe = pe;
-    f->tid = thread_current ()->tid;
+/**
+ * Put the page held by frame F back in place after page_out()
+ * failed on it, as unmap_frame() found it
+ * F must be busy for the current thread
+ */
+static void remap_frame (struct frame *f, bool dirty)
+{
+    uint32_t *page_table = f->thread->pagedir;
+    struct spl_pe *pe = f->spl_pe;
+
+    if (!pagedir_set_page (page_table, pe->upage, f->frame, pe->writable))
+        PANIC ("remap_frame: out of memory for page table");
+    pagedir_set_dirty (page_table, pe->upage, dirty);
+    pe->kpage = f->frame;
+    pe->present = true;
+}
 
+/**
+ * Hand busy frame F, put back in place by remap_frame(), to the
+ * clock again, unless its owner is in frame_exit() and so wants
+ * its frames pinned: its page directory is about to go away.
+ */
+static void restore_frame (struct frame *f)
+{
+    enum intr_level old_level = intr_disable ();
+    bool pinned = f->thread->frames_pinned;
+    f->state = pinned ? FRAME_PINNED : FRAME_MAPPED;
+    intr_set_level (old_level);
+    if (!pinned)
+        wake_frame_waiters ();
+}
+
+/**
+ * Clear the evicting bit of PE and wake up whoever waits on it.
+ * The evictor must not touch PE afterwards, as its owner may be
+ * about to free it.
+ */
+static void end_eviction (struct spl_pe *pe)
+{
+    lock_acquire (&evict_wait_lock);
+    pe->evicting = false;
+    cond_broadcast (&evict_done, &evict_wait_lock);
+    lock_release (&evict_wait_lock);
+}
+
+/**
+ * Wait until PE, if it is being evicted, has been written out.
+ */
+void frame_wait_evicted (struct spl_pe *pe)
+{
+    lock_acquire (&evict_wait_lock);
+    while (pe->evicting)
+        cond_wait (&evict_done, &evict_wait_lock);
+    lock_release (&evict_wait_lock);
+}
+
+/**
+ * Keep evictors away from the frames of the exiting thread, whose
+ * supplementary page table is SPL_PT, and wait for those already
+ * evicting one of its pages.  Its page directory and page table
+ * may be destroyed afterwards.
+ */
+void frame_exit (struct hash *spl_pt)
+{
+    struct thread *cur = thread_current ();
+    /* Evictors failing on a frame of ours from now on pin it, and
+       we pin the others here */
+    enum intr_level old_level = intr_disable ();
+    cur->frames_pinned = true;
+    intr_set_level (old_level);
+    for (size_t i = 0; i < frame_cnt; i++)
+    {
+        old_level = intr_disable ();
+        if (frame_table[i].state == FRAME_MAPPED && !frame_table[i].shared
+            && frame_table[i].thread == cur)
+            frame_table[i].state = FRAME_PINNED;
+        intr_set_level (old_level);
+    }
+
+    /* Shared frames stay with the other processes mapping them */
+    struct hash_iterator i;
+    hash_first (&i, spl_pt);
+    while (hash_next (&i))
+    {
+        struct spl_pe *pe = hash_entry (hash_cur (&i), struct spl_pe, elem);
+        frame_wait_evicted (pe);
+        if (pe->present && is_shareable (pe))
+            leave_shared (pe);
+        else if (is_zero_mapped (pe))
+        {
+            /* Keep pagedir_destroy() from freeing the zero page */
+            pagedir_clear_page (cur->pagedir, pe->upage);
+            pe->present = false;
+        }
+    }
+}
+
+/**
+ * Check whether shared frame F may be evicted: none of its sharers
+ * has it pinned or has used it since the last check.  If so, unmap
+ * it from all of them and mark their pages evicting.
+ * Need to assume that interrupts are off
+ */
+static bool claim_shared (struct frame *f)
+{
+    struct list_elem *e;
+    bool accessed = false;
+
+    ASSERT (intr_get_level () == INTR_OFF);
+    for (e = list_begin (&f->sharers); e != list_end (&f->sharers);
+         e = list_next (e))
+    {
+        struct spl_pe *pe = list_entry (e, struct spl_pe, share_elem);
+        uint32_t *page_table = pe->thread->pagedir;
+        if (pe->pinned)
+            return false;
+        if (pagedir_is_accessed (page_table, pe->upage))
+        {
+            accessed = true;
+            pagedir_set_accessed (page_table, pe->upage, false);
+        }
+    }
+    if (accessed)
+        return false;
+
+    for (e = list_begin (&f->sharers); e != list_end (&f->sharers);
+         e = list_next (e))
+    {
+        struct spl_pe *pe = list_entry (e, struct spl_pe, share_elem);
+        pagedir_clear_page (pe->thread->pagedir, pe->upage);
+        pe->present = false;
+        pe->kpage = NULL;
+        pe->evicting = true;
+    }
     return true;
 }
 
-void set_evictable (void *frame)
+/**
+ * Take busy shared frame F out of the share table, once it is
+ * evicted or failed to load, and let its sharers fault again.
+ */
+static void drop_shared (struct frame *f)
 {
-    lock_acquire (&ft_lock);
-    struct frame *fe = find_frame (frame);
-    if (fe != NULL)
-        fe->evictable = true;
-    lock_release (&ft_lock);
+    lock_acquire (&share_lock);
+    hash_delete (&share_table, &f->share_elem);
+    f->shared = false;
+    while (!list_empty (&f->sharers))
+        end_eviction (list_entry (list_pop_front (&f->sharers),
+                                  struct spl_pe, share_elem));
+    cond_broadcast (&share_ready, &share_lock);
+    lock_release (&share_lock);
 }
 
-void set_unevictable (void *frame)
+/**
+ * Unmap present page PE of the current thread from its shared
+ * frame, freeing the frame if PE was its last sharer.
+ */
+static void leave_shared (struct spl_pe *pe)
 {
-    lock_acquire (&ft_lock);
-    struct frame *fe = find_frame (frame);
-    if (fe != NULL)
-        fe->evictable = false;
-    lock_release (&ft_lock);
+    lock_acquire (&share_lock);
+    for (;;)
+    {
+        enum intr_level old_level = intr_disable ();
+        if (!pe->present)
+        {
+            /* Claimed by an evictor meanwhile */
+            intr_set_level (old_level);
+            lock_release (&share_lock);
+            frame_wait_evicted (pe);
+            return;
+        }
+        struct frame *f = find_frame (pe->kpage);
+        if (f->state == FRAME_BUSY)
+        {
+            /* Being joined by another process */
+            intr_set_level (old_level);
+            cond_wait (&share_ready, &share_lock);
+            continue;
+        }
+        list_remove (&pe->share_elem);
+        pagedir_clear_page (thread_current ()->pagedir, pe->upage);
+        pe->present = false;
+        pe->kpage = NULL;
+        bool last = list_empty (&f->sharers);
+        if (last)
+            f->state = FRAME_BUSY;
+        intr_set_level (old_level);
+        lock_release (&share_lock);
+        if (last)
+            palloc_free_page (f->frame);
+        return;
+    }
 }
 
-/* helper functions */
+/**
+ * Body of the page-out daemon.  Each time it is woken, it evicts
+ * pages until high_water user pages are free or it finds nothing
+ * more it can evict.
+ */
+static void pageout_daemon (void *aux UNUSED)
+{
+    for (;;)
+    {
+        sema_down (&pageout_sema);
+        while (palloc_user_free_cnt () < high_water && pageout_batch () > 0)
+            continue;
+        pageout_pending = false;
+    }
+}
+
+/**
+ * Evict up to SWAP_CLUSTER pages, no more than are missing for
+ * high_water, and give their frames back to the user pool.  The
+ * pages bound for the swap device are written to consecutive slots
+ * in one request, ordered by owner and address, so that faults can
+ * read them back around each other.
+ * Returns the number of pages evicted.
+ */
+static size_t pageout_batch (void)
+{
+    struct frame *batch[SWAP_CLUSTER];
+    bool dirty[SWAP_CLUSTER];
+    void *kpages[SWAP_CLUSTER];
+    size_t slots[SWAP_CLUSTER];
+    size_t free_cnt = palloc_user_free_cnt ();
+    size_t want = free_cnt < high_water ? high_water - free_cnt : 1;
+    size_t cnt = 0, swap_cnt = 0, evicted = 0;
+
+    if (want > SWAP_CLUSTER)
+        want = SWAP_CLUSTER;
+    while (cnt < want
+           && (batch[cnt] = get_frame_to_evict (dirty + cnt)) != NULL)
+        cnt++;
+    sort_batch (batch, dirty, cnt);
+
+    for (size_t i = 0; i < cnt; i++)
+        if (!batch[i]->shared && needs_swap (batch[i]->spl_pe, dirty[i]))
+        {
+            discard_slot (batch[i]->spl_pe);
+            kpages[swap_cnt++] = batch[i]->frame;
+        }
+    if (swap_cnt > 0)
+        swap_out_cluster (kpages, swap_cnt, slots);
+    swap_cnt = 0;
+
+    for (size_t i = 0; i < cnt; i++)
+    {
+        struct frame *fe = batch[i];
+        struct spl_pe *pe = fe->spl_pe;
+        if (fe->shared)
+        {
+            /* Clean, and reloaded from its file by each sharer */
+            drop_shared (fe);
+            palloc_free_page (fe->frame);
+            evicted++;
+            continue;
+        }
+        size_t slot = needs_swap (pe, dirty[i]) ? slots[swap_cnt++]
+                                                : BITMAP_ERROR;
+        bool success;
+        if (slot != BITMAP_ERROR)
+        {
+            pe->type = PG_SWAP;
+            pe->slot = slot;
+            success = true;
+        }
+        else
+            /* Also when no run of slots was free for the batch */
+            success = page_out (fe, dirty[i]);
+
+        if (success)
+        {
+            palloc_free_page (fe->frame);
+            evicted++;
+        }
+        else
+        {
+            remap_frame (fe, dirty[i]);
+            restore_frame (fe);
+        }
+        end_eviction (pe);
+    }
+    return evicted;
+}
+
+/**
+ * Sort the CNT victims in BATCH, and their DIRTY bits with them,
+ * by owner and then by user address.  Shared frames, which are
+ * never written, come first.
+ */
+static void sort_batch (struct frame **batch, bool *dirty, size_t cnt)
+{
+    for (size_t i = 1; i < cnt; i++)
+    {
+        struct frame *fe = batch[i];
+        bool d = dirty[i];
+        size_t j = i;
+        for (; j > 0; j--)
+        {
+            struct frame *prev = batch[j - 1];
+            if (!batch_before (fe, prev))
+                break;
+            batch[j] = prev;
+            dirty[j] = dirty[j - 1];
+        }
+        batch[j] = fe;
+        dirty[j] = d;
+    }
+}
 
-/* previous frame in a circular queue */
-static struct list_elem* next_frame (struct list_elem* frame_pt)
+/* Returns if victim A goes before victim B in a batch */
+static bool batch_before (const struct frame *a, const struct frame *b)
 {
-    if (frame_pt == NULL)
-        return list_begin (&frame_table);
-    ASSERT (frame_pt != list_end (&frame_table));
-    frame_pt = list_next (frame_pt);
-    return frame_pt == list_end (&frame_table) ? list_begin (&frame_table)
-         : frame_pt;
+    if (a->shared || b->shared)
+        return a->shared && !b->shared;
+    if (a->tid != b->tid)
+        return a->tid < b->tid;
+    return a->spl_pe->upage < b->spl_pe->upage;
 }
 
-/* next frame in a circular queue */
-static struct list_elem* prev_frame (struct list_elem* frame_pt)
+/**
+ * Allow the frame holding user page UPAGE of the current thread
+ * to be evicted again.
+ */
+void set_evictable (const void *upage)
 {
-    ASSERT (frame_pt != NULL);
-    if (frame_pt == list_head (&frame_table))
-        frame_pt = list_end (&frame_table);
-    return list_prev (frame_pt);
+    struct spl_pe *pe = find_spl_pe (&process_current ()->spl_page_table,
+                                     pg_round_down (upage));
+    enum intr_level old_level = intr_disable ();
+    struct frame *fe =
+        find_frame (pagedir_get_page (thread_current ()->pagedir, upage));
+    if (fe != NULL && fe->shared)
+        pe->pinned = false;
+    else if (fe != NULL && fe->state == FRAME_PINNED)
+        fe->state = FRAME_MAPPED;
+    intr_set_level (old_level);
+    wake_frame_waiters ();
 }
 
-static struct frame* find_frame (void *frame)
+/**
+ * Pin down the frame holding user page UPAGE of the current thread.
+ * Returns false if the page is not present, e.g. because it is
+ * being evicted.
+ */
+bool set_unevictable (const void *upage)
 {
-    for (struct list_elem *e = list_begin (&frame_table); 
-         e != list_end (&frame_table); e = list_next (e))
+    struct spl_pe *pe = find_spl_pe (&process_current ()->spl_page_table,
+                                     pg_round_down (upage));
+    enum intr_level old_level = intr_disable ();
+    struct frame *fe =
+        find_frame (pagedir_get_page (thread_current ()->pagedir, upage));
+    bool pinned;
+    if (fe != NULL && fe->shared)
+        pinned = pe->pinned = true;
+    else
     {
-        struct frame *f = list_entry (e, struct frame, elem);
-        if (f->frame == frame)
-            return f;
+        if (fe != NULL && fe->state == FRAME_MAPPED)
+            fe->state = FRAME_PINNED;
+        pinned = fe != NULL && fe->state == FRAME_PINNED;
     }
-    return NULL;
+    intr_set_level (old_level);
+    return pinned;
+}
+
+/* helper functions */
+
+/* Hashes a shared frame by the file and offset of its page */
+static unsigned hash_share (const struct hash_elem *e, void *aux UNUSED)
+{
+    struct frame *fe = hash_entry (e, struct frame, share_elem);
+    return hash_bytes (&fe->inode, sizeof fe->inode)
+           ^ hash_int (fe->offset);
+}
+
+static bool hash_less_share (const struct hash_elem *a,
+                             const struct hash_elem *b, void *aux UNUSED)
+{
+    struct frame *fa = hash_entry (a, struct frame, share_elem);
+    struct frame *fb = hash_entry (b, struct frame, share_elem);
+    if (fa->inode != fb->inode)
+        return fa->inode < fb->inode;
+    if (fa->offset != fb->offset)
+        return fa->offset < fb->offset;
+    return fa->read_bytes < fb->read_bytes;
+}
+
+/**
+ * Find the frame entry for user pool page FRAME.
+ * Returns NULL if FRAME is not a user pool page.
+ */
+static struct frame* find_frame (const void *frame)
+{
+    size_t idx = palloc_user_index (frame);
+    return idx != SIZE_MAX ? frame_table + idx : NULL;
 }
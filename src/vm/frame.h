@@ -1,25 +1,50 @@
 #ifndef __FRAME_H
 #define __FRAME_H
+#include <hash.h>
 #include <list.h>
+#include "filesys/off_t.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "vm/page.h"
 
-/* frame entry, or FE */
+/* state of a frame entry */
+enum frame_state {
+    FRAME_FREE,             /**< holds no page */
+    FRAME_BUSY,             /**< being loaded or evicted by one thread */
+    FRAME_MAPPED,           /**< mapped and may be evicted */
+    FRAME_PINNED            /**< mapped and may not be evicted */
+};
+
+/* frame entry, or FE, one per user pool page */
 struct frame{
     void *frame;            /**< the frame this FE represents */
     tid_t tid;              /**< TID of the thread holding the frame */
-    struct spl_pe *spl_pe;  /**< the SPE of this frame */
+    struct spl_pe *spl_pe;  /**< the SPE of this frame, while busy if
+                                 shared */
     struct thread *thread;  /**< the thread holding this frame */
-    struct list_elem elem;  /**< list elem */
-    struct lock frame_lock; /**< lock for frame loading */
-    bool evictable;         /**< allow pinning down */
+    enum frame_state state; /**< changed with interrupts off */
+
+    /* A shared frame holds a read-only page of an executable for all
+       the processes running it, whose SPEs are its sharers.  It is
+       evicted only when none of them has used it recently. */
+    bool shared;            /**< in the share table */
+    struct inode *inode;    /**< file the shared page is from */
+    off_t offset;           /**< its offset in the file */
+    uint32_t read_bytes;    /**< bytes it has from the file */
+    struct list sharers;    /**< SPEs mapping it */
+    struct hash_elem share_elem; /**< in the share table */
 };
-struct lock evict_lock;
 
 void frame_table_init (void);
 void remove_frame (void*);
-struct frame* get_frame (struct spl_pe*, bool);
-void set_evictable (void*);
-void set_unevictable (void*);
+void frame_freed (void);
+struct frame* get_frame (struct spl_pe*);
+struct frame* try_get_frame (struct spl_pe*);
+struct frame* get_shared_frame (struct spl_pe*, bool*);
+void abandon_frame (struct frame*);
+void release_frame (struct frame*, bool);
+void frame_wait_evicted (struct spl_pe*);
+void frame_exit (struct hash*);
+void set_evictable (const void*);
+bool set_unevictable (const void*);
 #endif
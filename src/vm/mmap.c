@@ -1,4 +1,5 @@
 #include <hash.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
@@ -47,16 +48,16 @@ mapid_t map_file (struct file *file, void *addr)
     }
     off_t read_bytes = file_length (file);
     lock_release (&file_lock);
-    if (!check_page_validity (addr, read_bytes))
-        return MMAP_ERROR;
-    struct hash* spt = &process_current ()->spl_page_table;
-    for (int idx = 0; idx * PGSIZE < read_bytes; idx++)
+    /* Pages are read in as they are used */
+    if (!check_page_validity (addr, read_bytes)
+        || !add_vma (PG_MMAP, &process_current ()->vm_areas, file, 0, addr,
+                     read_bytes, ROUND_UP (read_bytes, PGSIZE) - read_bytes,
+                     true))
     {
-        size_t page_read_bytes = (read_bytes - idx * PGSIZE) < PGSIZE 
-                                 ? (read_bytes - idx * PGSIZE) : PGSIZE;
-        add_spl_pe (PG_MMAP, spt, file, idx * PGSIZE, 
-                    addr + idx * PGSIZE, page_read_bytes, 
-                    PGSIZE - page_read_bytes, true);
+        lock_acquire (&file_lock);
+        file_close (file);
+        lock_release (&file_lock);
+        return MMAP_ERROR;
     }
     /* add mmap file entry into mmap_table */
     return insert_mmap_file (file, addr);
@@ -122,6 +123,7 @@ static void hash_unmap_file (struct hash_elem *e, void *aux UNUSED)
         read_bytes -= page_read_bytes;
         upage += PGSIZE;
     }
+    rm_vma (&process_current ()->vm_areas, file->addr);
 
     lock_acquire (&file_lock);
     file_close (file->file);
@@ -151,15 +153,11 @@ static mapid_t insert_mmap_file (struct file *file, void *addr)
 }
 
 /**
- * Verify that the pages are not mapped
+ * Verify that the pages are not mapped, nor left for the stack
  * @return true if page is valid
  */
 static bool check_page_validity (const void *buffer, unsigned size)
 {
   ASSERT (pg_ofs (buffer) == 0);
-  struct hash *spt = &process_current ()->spl_page_table;
-  for (unsigned tmp = 0; tmp <= (size - 1) / PGSIZE; tmp++)
-    if (find_spl_pe (spt, buffer + tmp * PGSIZE)) 
-        return false;
-  return true;
+  return size > 0 && is_range_free (buffer, size);
 }
\ No newline at end of file
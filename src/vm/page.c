@@ -1,5 +1,7 @@
 #include <stdio.h>
+#include <bitmap.h>
 #include <hash.h>
+#include <round.h>
 #include <string.h>
 #include "threads/thread.h"
 #include "threads/malloc.h"
@@ -17,7 +19,24 @@
 #include "vm/swap.h"
 
 static bool install_page (void *, void *, bool);
+
+/* Read-only frame of zeroes mapped by demand-zero pages until they
+   are first written to */
+static void *zero_page;
+
+/* Most pages mapped in by a fault on a file-backed page */
+static int fault_around = 4;
 static bool load_frame (struct spl_pe*, void*);
+static bool load_file (struct spl_pe*, void*);
+static struct spl_pe* insert_spl_pe (enum page_type, struct hash*,
+                                     struct file*, off_t, uint8_t*,
+                                     uint32_t, uint32_t, bool);
+static struct vm_area* find_vma (struct list*, const uint8_t*);
+static bool share_last_page (struct vm_area*, uint32_t, bool);
+static struct spl_pe* file_neighbor (struct spl_pe*, int);
+static void load_swap (struct spl_pe*, void*);
+static bool map_read_around (struct spl_pe*, struct frame**);
+static struct spl_pe* swapped_neighbor (struct hash*, struct spl_pe*, int);
 
 /* hash functions required by hash table implementation */
 unsigned hash_spl_pe (const struct hash_elem *e, void *aux UNUSED)
@@ -36,60 +55,140 @@ bool hash_less_spl_pe (const struct hash_elem *a,
 
 void hash_free_spl_pe (struct hash_elem *e, void *aux UNUSED)
 {
-    free (hash_entry (e, struct spl_pe, elem));
+    struct spl_pe *pe = hash_entry (e, struct spl_pe, elem);
+    if (pe->slot != BITMAP_ERROR)
+        swap_free (pe->slot);
+    free (pe);
 }
 
 
+/**
+ * Set up the zero page
+ */
+void page_init (void)
+{
+    zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
 /**
  * Load page at UPAGE on page table
  * Could be stack or file
  * Could be in swap, demand zero or simply needs to read from file
+ * A demand-zero page read before it is written maps the zero page,
+ * and gets a frame of its own on the first WRITE.
  * If no frame is available, try to do eviction
  */
-bool load_page (uint8_t *upage, bool evictable)
+bool load_page (uint8_t *upage, bool write, bool evictable)
 {
     ASSERT (pg_ofs (upage) == 0);
     bool success = false;
-    struct hash *spl_pt = &process_current ()->spl_page_table;
-    struct spl_pe *pe = find_spl_pe (spl_pt, upage);
+    struct spl_pe *pe = get_spl_pe (upage);
     /* If upage not in spt */
     if (pe == NULL)
         goto done;
     ASSERT (pe->upage == upage);
 
-    /* If access issues */
+    /* If the page is still being written out, wait for the evictor
+       so that its type tells where it ended up: a demand-zero page
+       may have gone to swap.  An evictor that failed put the page
+       back in place, to be pinned if asked unless it was picked
+       again meanwhile. */
+    while (!pe->present && pe->evicting)
+    {
+        frame_wait_evicted (pe);
+        if (pe->present && (evictable || set_unevictable (upage)))
+        {
+            success = true;
+            goto done;
+        }
+    }
+
     if (pe->present)
+    {
+        /* Other present pages fault only on access issues */
+        if (pe->kpage != zero_page)
+            goto done;
+        /* The zero page is never evicted, so it needs no pinning */
+        if (!write)
+        {
+            success = true;
+            goto done;
+        }
+        if (!pe->writable)
+            goto done;
+        /* Copy on write: the copy is a new frame, zeroed when loaded */
+        pagedir_clear_page (thread_current ()->pagedir, upage);
+        pe->present = false;
+        pe->kpage = NULL;
+    }
+    else if (pe->type == PG_ZERO && !write)
+    {
+        if (!install_page (upage, zero_page, false))
+            goto done;
+        pe->kpage = zero_page;
+        pe->present = true;
+        success = true;
         goto done;
+    }
 
     /* pe is the supplementary page entry that triggered PF */
-    struct frame* frame = get_frame (pe, evictable);
+    bool loaded = false;
+    struct frame* frame = is_shareable (pe) ? get_shared_frame (pe, &loaded)
+                                            : get_frame (pe);
     if (frame == NULL)
         goto done;
 
     ASSERT (!pe->present);
     pe->kpage = frame->frame;
 
-    /* Load the content of the frame */
-    if (!load_frame (pe, frame->frame))
+    /* Load the content of the frame, unless another process has */
+    if (!loaded && !load_frame (pe, frame->frame))
     {
-        palloc_free_page (frame->frame);
+        abandon_frame (frame);
         goto done;
     }
 
     /* Add the page to the process's address space. */
     if (!install_page (upage, frame->frame, pe->writable)) 
     {
-        palloc_free_page (frame->frame);
+        abandon_frame (frame);
         goto done;
     }
     pe->present = true;
-    lock_release (&frame->frame_lock);
+    release_frame (frame, evictable);
     success = true;
 done:
     return success;
 }
 
-bool grow_stack (void* upage, const void* esp UNUSED)
+/**
+ * Returns true if page PE is mapped to the zero page
+ */
+bool is_zero_mapped (const struct spl_pe *pe)
+{
+    return pe->present && pe->kpage == zero_page;
+}
+
+/**
+ * Returns true if page PE is read-only code or data of an
+ * executable, whose frame processes running it can share.
+ */
+bool is_shareable (const struct spl_pe *pe)
+{
+    return (pe->type == PG_FILE || pe->type == PG_MISC) && !pe->writable;
+}
+
+/**
+ * Map in up to PAGES file-backed pages per fault, 1 to turn
+ * fault-around off.
+ */
+void set_fault_around (int pages)
+{
+    fault_around = pages < 1 ? 1 
+                 : pages > FAULT_AROUND_MAX ? FAULT_AROUND_MAX : pages;
+}
+
+bool grow_stack (void* upage, const void* esp UNUSED, bool write)
 {
     ASSERT (pg_ofs (upage) == 0);
     bool success = false;
@@ -102,7 +201,7 @@ bool grow_stack (void* upage, const void* esp UNUSED)
         if (!add_spl_pe (PG_ZERO, &pt->process->spl_page_table, NULL, 0, 
                          p, 0, PGSIZE, true))
             goto done;
-    if (!load_page (upage, true))
+    if (!load_page (upage, write, true))
         goto done;
     success = true;
 done:
@@ -113,10 +212,23 @@ done:
 bool add_spl_pe (enum page_type type, struct hash *spl_pt, struct file *file,
                  off_t offset, uint8_t *upage, uint32_t read_bytes, 
                  uint32_t zero_bytes, bool writable)
+{
+    return insert_spl_pe (type, spl_pt, file, offset, upage, read_bytes,
+                          zero_bytes, writable) != NULL;
+}
+
+/**
+ * Add a page entry like add_spl_pe()
+ * returns the entry, or NULL if failed
+ */
+static struct spl_pe*
+insert_spl_pe (enum page_type type, struct hash *spl_pt, struct file *file,
+               off_t offset, uint8_t *upage, uint32_t read_bytes,
+               uint32_t zero_bytes, bool writable)
 {
     struct spl_pe *pe = malloc (sizeof (struct spl_pe));
     if (pe == NULL)
-        return false;
+        return NULL;
     pe->type = type;
     pe->file = file;
     pe->offset = offset;
@@ -126,13 +238,116 @@ bool add_spl_pe (enum page_type type, struct hash *spl_pt, struct file *file,
     pe->zero_bytes = zero_bytes;
     pe->writable = writable;
     pe->present = false;
-    pe->slot = -1;
+    pe->evicting = false;
+    pe->pinned = false;
+    pe->thread = NULL;
+    pe->slot = BITMAP_ERROR;
 
     if (hash_insert (spl_pt, &pe->elem) != NULL)
     {
         /* If entry already in supplementary page table */
         free (pe);
+        return NULL;
+    }
+    return pe;
+}
+
+/**
+ * Add a VMA to the list VMAS, mapping READ_BYTES bytes of FILE from
+ * OFFSET on at user page START, followed by ZERO_BYTES zeroes.
+ * Pages of a PG_FILE area are PG_FILE, PG_MISC or PG_ZERO by how
+ * much of them is read; those of a PG_MMAP area are all PG_MMAP.
+ * An executable's segments, added in address order, may share a
+ * page where one ends and the next begins; that page gets a VMA of
+ * its own, reading the bytes of both and writable if either is.
+ * Returns false if it overlaps another VMA otherwise or memory is
+ * short.
+ */
+bool add_vma (enum page_type type, struct list *vmas, struct file *file,
+              off_t offset, uint8_t *start, uint32_t read_bytes,
+              uint32_t zero_bytes, bool writable)
+{
+    ASSERT (pg_ofs (start) == 0);
+    ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
+    uint8_t *end = start + read_bytes + zero_bytes;
+    struct list_elem *e;
+    for (e = list_begin (vmas); e != list_end (vmas); e = list_next (e))
+    {
+        struct vm_area *vma = list_entry (e, struct vm_area, elem);
+        if (vma->start >= end)
+            break;
+        if (vma->end <= start)
+            continue;
+        if (type != PG_FILE || vma->type != PG_FILE || vma->file != file
+            || vma->end != start + PGSIZE
+            || vma->offset + (start - vma->start) != offset)
+            return false;
+        if (!share_last_page (vma, read_bytes, writable))
+            return false;
+        if (end == start + PGSIZE)
+            return true;
+        read_bytes = read_bytes > PGSIZE ? read_bytes - PGSIZE : 0;
+        return add_vma (type, vmas, file, offset + PGSIZE, start + PGSIZE,
+                        read_bytes, end - start - PGSIZE - read_bytes,
+                        writable);
+    }
+
+    struct vm_area *vma = malloc (sizeof (struct vm_area));
+    if (vma == NULL)
         return false;
+    vma->type = type;
+    vma->file = file;
+    vma->offset = offset;
+    vma->start = start;
+    vma->end = end;
+    vma->read_bytes = read_bytes;
+    vma->writable = writable;
+    list_insert (e, &vma->elem);
+    return true;
+}
+
+/**
+ * Remove the VMA starting at user page START from the list VMAS.
+ * The SPEs created for its pages are left to the caller.
+ */
+void rm_vma (struct list *vmas, uint8_t *start)
+{
+    struct vm_area *vma = find_vma (vmas, start);
+    ASSERT (vma != NULL && vma->start == start);
+    list_remove (&vma->elem);
+    free (vma);
+}
+
+/**
+ * Free all the VMAs in the list VMAS
+ */
+void free_vmas (struct list *vmas)
+{
+    while (!list_empty (vmas))
+        free (list_entry (list_pop_front (vmas), struct vm_area, elem));
+}
+
+/**
+ * Returns true if no page of the SIZE bytes from user page START on
+ * is in a VMA or in the area the stack may grow into.
+ */
+bool is_range_free (const void *start, size_t size)
+{
+    const uint8_t *stack_bottom = (uint8_t *) PHYS_BASE - STACK_SIZE;
+    const uint8_t *first = start;
+    if (first >= stack_bottom || size > (size_t) (stack_bottom - first))
+        return false;
+    const uint8_t *end = first + ROUND_UP (size, PGSIZE);
+
+    struct list *vmas = &process_current ()->vm_areas;
+    for (struct list_elem *e = list_begin (vmas); e != list_end (vmas);
+         e = list_next (e))
+    {
+        struct vm_area *vma = list_entry (e, struct vm_area, elem);
+        if (vma->start >= end)
+            break;
+        if (vma->end > first)
+            return false;
     }
     return true;
 }
@@ -154,15 +369,20 @@ bool page_unmap (uint32_t *pd, uint8_t *upage)
 {
     struct hash *spt = &process_current ()->spl_page_table;
     struct spl_pe *pe = find_spl_pe (spt, upage);
-    ASSERT (pe != NULL);
-    if (pagedir_get_page (pd, upage) && pagedir_is_dirty (pd, upage))
+    /* A page never used has nothing to write back */
+    if (pe == NULL)
+        return true;
+    /* Pin the page, or wait until an evictor has written it out, so
+       that no evictor still uses it once it is gone */
+    bool present;
+    while (!(present = set_unevictable (upage)) && pe->evicting)
+        frame_wait_evicted (pe);
+    if (present && pagedir_is_dirty (pd, upage))
     {
         /* Write back the memory content */
-        lock_acquire (&file_lock);
         if ((uint32_t) file_write_at (pe->file, upage, pe->read_bytes, 
                                     pe->offset) != pe->read_bytes)
             return false;
-        lock_release (&file_lock);
     }
     /* Unmap the memory area */
     palloc_free_page (pagedir_get_page (pd, upage));
@@ -176,8 +396,7 @@ bool page_unmap (uint32_t *pd, uint8_t *upage)
 /* returns if a user page UPAGE is writable */
 bool is_writable (const void *upage)
 {
-    struct hash *spl_pt = &process_current ()->spl_page_table;
-    struct spl_pe *pe = find_spl_pe (spl_pt, pg_round_down (upage));
+    struct spl_pe *pe = get_spl_pe (pg_round_down (upage));
     ASSERT (pe != NULL);
     return pe -> writable;
 }
@@ -193,8 +412,91 @@ struct spl_pe* find_spl_pe (struct hash *hash, uint8_t *upage)
     return p ? hash_entry(p, struct spl_pe, elem) : NULL;
 }
 
+/**
+ * Finds the supplementary page entry of the current process for
+ * UPAGE, creating it from the VMA UPAGE is in when the page is
+ * first used.
+ * Returns NULL if UPAGE is not mapped.
+ */
+struct spl_pe* get_spl_pe (uint8_t *upage)
+{
+    struct process *p = process_current ();
+    struct spl_pe *pe = find_spl_pe (&p->spl_page_table, upage);
+    if (pe != NULL)
+        return pe;
+    struct vm_area *vma = find_vma (&p->vm_areas, upage);
+    if (vma == NULL)
+        return NULL;
+
+    size_t ofs = upage - vma->start;
+    uint32_t read_bytes = vma->read_bytes <= ofs ? 0
+                        : vma->read_bytes - ofs < PGSIZE
+                        ? vma->read_bytes - ofs : PGSIZE;
+    enum page_type type = vma->type;
+    if (type == PG_FILE && read_bytes < PGSIZE)
+        type = read_bytes == 0 ? PG_ZERO : PG_MISC;
+    return insert_spl_pe (type, &p->spl_page_table, vma->file,
+                          vma->offset + ofs, upage, read_bytes,
+                          PGSIZE - read_bytes, vma->writable);
+}
+
 /* Helper Functions */
 
+/**
+ * Let the last page of PG_FILE area VMA also hold the first page of
+ * another segment, which reads READ_BYTES bytes from the same file
+ * page on and is WRITABLE as given.  The page is split off into a
+ * VMA of its own unless it is all of VMA.
+ * returns false if memory is short
+ */
+static bool share_last_page (struct vm_area *vma, uint32_t read_bytes,
+                             bool writable)
+{
+    uint8_t *page = vma->end - PGSIZE;
+    size_t ofs = page - vma->start;
+    uint32_t page_read = vma->read_bytes <= ofs ? 0 : vma->read_bytes - ofs;
+    if (read_bytes < page_read)
+        read_bytes = page_read;
+    if (read_bytes > PGSIZE)
+        read_bytes = PGSIZE;
+
+    if (page != vma->start)
+    {
+        struct vm_area *last = malloc (sizeof (struct vm_area));
+        if (last == NULL)
+            return false;
+        *last = *vma;
+        last->offset += ofs;
+        last->start = page;
+        vma->end = page;
+        if (vma->read_bytes > ofs)
+            vma->read_bytes = ofs;
+        list_insert (list_next (&vma->elem), &last->elem);
+        vma = last;
+    }
+    vma->read_bytes = read_bytes;
+    vma->writable = vma->writable || writable;
+    return true;
+}
+
+/**
+ * Finds the VMA in the list VMAS that user address UPAGE is in
+ * returns NULL if there is none
+ */
+static struct vm_area* find_vma (struct list *vmas, const uint8_t *upage)
+{
+    for (struct list_elem *e = list_begin (vmas); e != list_end (vmas);
+         e = list_next (e))
+    {
+        struct vm_area *vma = list_entry (e, struct vm_area, elem);
+        if (upage < vma->start)
+            break;
+        if (upage < vma->end)
+            return vma;
+    }
+    return NULL;
+}
+
 /** 
  * map a WRITABLE user page UPAGE to kernel frame KPAGE
  */
@@ -212,13 +514,13 @@ install_page (void *upage, void *kpage, bool writable)
 /**
  * Load the content of a frame according to the
  * supplementary table entry it corresponds to.
- * Needs frame table lock, frame lock and ste lock.
+ * The frame must be busy for the current thread.
  */
 static bool load_frame (struct spl_pe *pe, void *kpage)
 {
     /* If page is in swap */
     if (pe->type == PG_SWAP)
-        swap_in (pe->slot, kpage);
+        load_swap (pe, kpage);
     else
     {
         /* Load this page. */
@@ -226,24 +528,197 @@ static bool load_frame (struct spl_pe *pe, void *kpage)
         {
             ASSERT (pe->file != NULL);
             ASSERT (pe->read_bytes + pe->zero_bytes == PGSIZE);
-            bool flag = lock_held_by_current_thread (&file_lock);
-            if (!flag)
-                lock_acquire (&file_lock);
-            off_t prev_pos = file_tell (pe->file);
-            file_seek (pe->file, pe->offset);
             /* file read failed */
-            if (file_read (pe->file, kpage, pe->read_bytes) 
-                != (int) pe->read_bytes)
-            {
-                if (!flag)
-                    lock_release (&file_lock);
+            if (!load_file (pe, kpage))
                 return false; 
-            }
-            file_seek (pe->file, prev_pos);
-            if (!flag)
-                lock_release (&file_lock);
         }
-        memset (kpage + pe->read_bytes, 0, pe->zero_bytes);
+        else
+            memset (kpage + pe->read_bytes, 0, pe->zero_bytes);
     }
     return true;    
 }
+
+/**
+ * Read the page of PE from its file into KPAGE, together with the
+ * pages around it, within the fault-around window it falls in, that
+ * continue the same run of the file, as far as there are free
+ * frames for them.  All are read with one pass over the file.
+ * Those are mapped in too, left unaccessed so that the clock takes
+ * them back first if they go unused.
+ * Returns false if the file could not be read.
+ */
+static bool load_file (struct spl_pe *pe, void *kpage)
+{
+    struct spl_pe *run[FAULT_AROUND_MAX];
+    struct frame *frames[FAULT_AROUND_MAX];
+    void *kpages[FAULT_AROUND_MAX];
+    /* A shared page is read just once for all processes, so it is
+       not worth holding private copies of its neighbours */
+    int window = is_shareable (pe) ? 1 : fault_around;
+    /* The window is aligned to its size in the address space */
+    int pos = pg_no (pe->upage) % window;
+    int before = 0, after = 0, i;
+
+    /* Only the last page of a run may be short of file data */
+    while (before < pos)
+    {
+        struct spl_pe *npe = file_neighbor (pe, -(before + 1));
+        if (npe == NULL || npe->read_bytes != PGSIZE)
+            break;
+        before++;
+    }
+    for (struct spl_pe *last = pe; 
+         pos + after + 1 < window && last->read_bytes == PGSIZE;
+         after++)
+        if ((last = file_neighbor (pe, after + 1)) == NULL)
+            break;
+
+    /* RUN[BEFORE] is PE itself.  On each side the run ends at the
+       first page that gets no frame. */
+    run[before] = pe;
+    for (i = 1; i <= after; i++)
+    {
+        run[before + i] = file_neighbor (pe, i);
+        if (!map_read_around (run[before + i], frames + before + i))
+            break;
+    }
+    after = i - 1;
+    for (i = 1; i <= before; i++)
+    {
+        run[before - i] = file_neighbor (pe, -i);
+        if (!map_read_around (run[before - i], frames + before - i))
+            break;
+    }
+    int first = before - (i - 1);
+    int end = before + after + 1;
+
+    /* Pages up to the first failed read are good */
+    off_t ofs = run[first]->offset;
+    for (i = first; i < end; i++, ofs += PGSIZE)
+    {
+        kpages[i] = i == before ? kpage : frames[i]->frame;
+        if (file_read_at (pe->file, kpages[i], run[i]->read_bytes, ofs)
+            != (off_t) run[i]->read_bytes)
+            break;
+        memset (kpages[i] + run[i]->read_bytes, 0, run[i]->zero_bytes);
+    }
+    int good = i;
+
+    uint32_t *pd = thread_current ()->pagedir;
+    for (i = first; i < end; i++)
+        if (i != before && i < good)
+        {
+            run[i]->kpage = kpages[i];
+            run[i]->present = true;
+            release_frame (frames[i], true);
+        }
+        else if (i != before)
+        {
+            pagedir_clear_page (pd, run[i]->upage);
+            palloc_free_page (frames[i]->frame);
+        }
+    return before < good;
+}
+
+/**
+ * Returns the entry of the page K pages away from PE if it is not
+ * present and holds the part of the same file K pages away from
+ * that of PE, NULL otherwise.
+ */
+static struct spl_pe*
+file_neighbor (struct spl_pe *pe, int k)
+{
+    struct spl_pe *npe = get_spl_pe (pe->upage + k * PGSIZE);
+    if (npe == NULL || npe->type != pe->type || npe->file != pe->file
+        || npe->writable != pe->writable
+        || npe->present || npe->evicting || npe->read_bytes == 0
+        || npe->offset != pe->offset + k * PGSIZE)
+        return NULL;
+    return npe;
+}
+
+/**
+ * Read the page of PE from swap into KPAGE, together with the pages
+ * around it that were swapped out to the slots around its own, as
+ * far as there are free frames for them.  Those are mapped in too,
+ * left unaccessed so that the clock takes them back first if they
+ * go unused.
+ */
+static void load_swap (struct spl_pe *pe, void *kpage)
+{
+    struct hash *spt = &process_current ()->spl_page_table;
+    struct spl_pe *run[SWAP_CLUSTER];
+    struct frame *frames[SWAP_CLUSTER];
+    void *kpages[SWAP_CLUSTER];
+    int before = 0, after = 0, i;
+
+    /* Look ahead first, then behind */
+    while (after + 1 < SWAP_CLUSTER && swapped_neighbor (spt, pe, after + 1))
+        after++;
+    while (before + after + 1 < SWAP_CLUSTER
+           && swapped_neighbor (spt, pe, -(before + 1)))
+        before++;
+
+    /* RUN[BEFORE] is PE itself.  On each side the run ends at the
+       first page that gets no frame. */
+    run[before] = pe;
+    for (i = 1; i <= after; i++)
+    {
+        run[before + i] = swapped_neighbor (spt, pe, i);
+        if (!map_read_around (run[before + i], frames + before + i))
+            break;
+    }
+    after = i - 1;
+    for (i = 1; i <= before; i++)
+    {
+        run[before - i] = swapped_neighbor (spt, pe, -i);
+        if (!map_read_around (run[before - i], frames + before - i))
+            break;
+    }
+    int first = before - (i - 1);
+    int end = before + after + 1;
+
+    for (i = first; i < end; i++)
+        kpages[i] = i == before ? kpage : frames[i]->frame;
+    swap_in_cluster (pe->slot - (before - first), kpages + first, end - first);
+
+    for (i = first; i < end; i++)
+        if (i != before)
+        {
+            run[i]->kpage = kpages[i];
+            run[i]->present = true;
+            release_frame (frames[i], true);
+        }
+}
+
+/**
+ * Get a free frame for NPE, read around another page, in *F and map
+ * it in.  Returns false if there is no free frame.
+ */
+static bool map_read_around (struct spl_pe *npe, struct frame **f)
+{
+    *f = try_get_frame (npe);
+    if (*f == NULL)
+        return false;
+    if (!install_page (npe->upage, (*f)->frame, npe->writable))
+    {
+        palloc_free_page ((*f)->frame);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Returns the entry of the page K pages away from PE if it is
+ * swapped out to the slot K slots away from that of PE,
+ * NULL otherwise.
+ */
+static struct spl_pe*
+swapped_neighbor (struct hash *spt, struct spl_pe *pe, int k)
+{
+    struct spl_pe *npe = find_spl_pe (spt, pe->upage + k * PGSIZE);
+    if (npe == NULL || npe->type != PG_SWAP || npe->present 
+        || npe->evicting || npe->slot != pe->slot + k)
+        return NULL;
+    return npe;
+}
@@ -1,8 +1,10 @@
 #ifndef __SPL_PT_H
 #define __SPL_PT_H
 #include <hash.h>
+#include <list.h>
 #include "filesys/off_t.h"
 #define STACK_SIZE (128*PGSIZE)
+#define FAULT_AROUND_MAX 16
 
 enum page_type {
     PG_FILE,
@@ -21,24 +23,52 @@ struct spl_pe{
     uint8_t *kpage;         /**< physical frame */
     uint32_t read_bytes;    /**< bytes to be read */
     uint32_t zero_bytes;    /**< bytes to be set to zero */
-    size_t slot;            /**< swap slot this page is in */
+    size_t slot;            /**< swap slot holding a copy of this page,
+                                 kept after swap-in until it is written */
     bool writable;          /**< is writable */
     bool present;           /**< is present in physical memory */
+    bool evicting;          /**< is being written out by an evictor */
+    bool pinned;            /**< may not be evicted, if shared */
+    struct thread *thread;  /**< thread mapping it, if shared */
+    struct list_elem share_elem; /**< in the sharers of its frame */
     struct hash_elem elem;  /**< hash elem */
 };
 
+/* virtual memory area, or VMA: pages mapped together, whose SPEs
+   are only created as each of them is first used */
+struct vm_area {
+    enum page_type type;    /**< PG_FILE for a segment, or PG_MMAP */
+    struct file *file;      /**< the file backing it */
+    off_t offset;           /**< file offset of its first page */
+    uint8_t *start;         /**< first user page */
+    uint8_t *end;           /**< user page past the last one */
+    uint32_t read_bytes;    /**< bytes to be read, the rest is zeroed */
+    bool writable;          /**< is writable */
+    struct list_elem elem;  /**< list elem, in address order */
+};
+
 unsigned hash_spl_pe (const struct hash_elem*, void*);
 bool hash_less_spl_pe (const struct hash_elem*,
                        const struct hash_elem*, void*);
 void hash_free_spl_pe (struct hash_elem*, void*);
 struct spl_pe* find_spl_pe (struct hash*, uint8_t*);
+struct spl_pe* get_spl_pe (uint8_t*);
 
-bool load_page (uint8_t*, bool);
-bool grow_stack (void*, const void*);
+void page_init (void);
+bool load_page (uint8_t*, bool, bool);
+bool grow_stack (void*, const void*, bool);
+void set_fault_around (int);
 bool add_spl_pe (enum page_type, struct hash*, struct file*, 
                  off_t, uint8_t*, uint32_t, uint32_t, bool);
 bool rm_spl_pe (uint8_t*);
+bool add_vma (enum page_type, struct list*, struct file*,
+              off_t, uint8_t*, uint32_t, uint32_t, bool);
+void rm_vma (struct list*, uint8_t*);
+void free_vmas (struct list*);
+bool is_range_free (const void*, size_t);
 bool is_writable (const void*);
+bool is_shareable (const struct spl_pe*);
+bool is_zero_mapped (const struct spl_pe*);
 void free_spl_pt (struct hash*);
 bool page_unmap (uint32_t*, uint8_t*);
 
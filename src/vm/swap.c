@@ -1,7 +1,11 @@
 #include "vm/swap.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <string.h>
 #include "devices/block.h"
+#include "filesys/lz.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "threads/synch.h"
@@ -10,53 +14,273 @@
 static struct block *swap_device;
 static struct bitmap *map;
 static struct lock swap_lock;
+static size_t next_slot;        /* where to look for free slots first */
+static size_t dev_slots;        /* slots on the swap device */
+
+/* Compressed tier.  Evicted pages that compress to ZSWAP_MAX_LEN
+   bytes or less are kept in memory, packed into pages taken from
+   the kernel pool up to a budget, under slot numbers that follow
+   those of the swap device.  Other pages, and those that do not
+   fit in the budget or find no free kernel page, go to the
+   device. */
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+#define ZSWAP_ENTRIES_PER_PAGE 32
+
+/* a kernel page holding compressed pages */
+struct zpage {
+    uint8_t *base;              /* the page, NULL if not allocated */
+    size_t used;                /* bytes handed out from BASE */
+    size_t live;                /* entries still stored in it */
+};
+
+/* a compressed page, for slot dev_slots + its index */
+struct zentry {
+    struct zpage *page;         /* where it is, NULL if free */
+    uint16_t ofs;               /* offset in PAGE */
+    uint16_t len;               /* compressed length */
+};
+
+static struct lock zswap_lock;
+static struct zpage *zpages;
+static size_t zpage_cnt;
+static struct zentry *zentries;
+static size_t zentry_cnt;
+static struct zpage *zopen;     /* page new entries are added to */
+static size_t zentry_hint;      /* where to look for free entries */
+static uint8_t zbuf[ZSWAP_MAX_LEN];
+static uint8_t zwork[LZ_WORK_SIZE];
+
+static size_t zswap_store (const void*);
+static void zswap_load (size_t, void*);
+static void zswap_free (size_t);
 
 void swap_init (void)
 {
     swap_device = block_get_role (BLOCK_SWAP);
     if (swap_device == NULL)
         PANIC ("swap_init: no swap device found");
-    map = bitmap_create (block_size (swap_device) / SECTOR_PER_PAGE);
+    dev_slots = block_size (swap_device) / SECTOR_PER_PAGE;
+    map = bitmap_create (dev_slots);
     if (map == NULL)
         PANIC ("swap_init: bitmap creation failed");
     lock_init (&swap_lock);
+    next_slot = 0;
+
+    /* Let the tier grow to an eighth of the user pool's size, but
+       to no more than a quarter of the kernel pool left at boot */
+    zpage_cnt = palloc_user_page_cnt () / 8;
+    if (zpage_cnt > palloc_kernel_free_cnt () / 4)
+        zpage_cnt = palloc_kernel_free_cnt () / 4;
+    if (zpage_cnt == 0)
+        zpage_cnt = 1;
+    zentry_cnt = zpage_cnt * ZSWAP_ENTRIES_PER_PAGE;
+    zpages = calloc (zpage_cnt, sizeof *zpages);
+    zentries = calloc (zentry_cnt, sizeof *zentries);
+    if (zpages == NULL || zentries == NULL)
+        PANIC ("swap_init: compressed tier allocation failed");
+    zopen = NULL;
+    zentry_hint = 0;
+    lock_init (&zswap_lock);
 }
 
 /**
  * Swap out the frame located at KPAGE
- * returns the slot number assigned in the swap device
+ * returns the slot number assigned to it
  * if failed, return BITMAP_ERROR
  */
 size_t swap_out (void *kpage)
 {
-    ASSERT (pg_ofs (kpage) == 0);
-    lock_acquire (&swap_lock);
-    size_t slot = bitmap_scan_and_flip (map, 0, 1, false);
-    if (slot == BITMAP_ERROR)
+    size_t slot;
+    swap_out_cluster (&kpage, 1, &slot);
+    return slot;
+}
+
+/**
+ * Swap out the CNT frames at KPAGES, storing the slot assigned to
+ * each in SLOTS.  Pages that compress well stay in the compressed
+ * tier; the rest go to consecutive slots on the device, written
+ * with a single request.
+ * returns the number of pages swapped out; the slot of the others
+ * is BITMAP_ERROR, as there was no free run of slots for them
+ */
+size_t swap_out_cluster (void **kpages, size_t cnt, size_t *slots)
+{
+    struct block_iovec iov[SWAP_CLUSTER];
+    size_t dev_cnt = 0, stored = 0;
+    ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+    for (size_t i = 0; i < cnt; i++)
     {
-        printf("errored");
-        lock_release (&swap_lock);
-        return BITMAP_ERROR;
+        ASSERT (pg_ofs (kpages[i]) == 0);
+        slots[i] = zswap_store (kpages[i]);
+        if (slots[i] != BITMAP_ERROR)
+            stored++;
+        else
+        {
+            iov[dev_cnt].buffer = kpages[i];
+            iov[dev_cnt++].cnt = SECTOR_PER_PAGE;
+        }
     }
-    for (size_t i = 0; i < SECTOR_PER_PAGE; i++)
-        block_write (swap_device, slot * SECTOR_PER_PAGE + i,
-                     kpage + i * BLOCK_SECTOR_SIZE);
+    if (dev_cnt == 0)
+        return stored;
+
+    lock_acquire (&swap_lock);
+    /* Allocate next-fit, so that successive clusters go out in
+       ascending order and the device sees one sequential stream */
+    size_t slot = bitmap_scan_and_flip (map, next_slot, dev_cnt, false);
+    if (slot == BITMAP_ERROR && next_slot != 0)
+        slot = bitmap_scan_and_flip (map, 0, dev_cnt, false);
+    if (slot != BITMAP_ERROR)
+        next_slot = slot + dev_cnt;
     lock_release (&swap_lock);
-    return slot;
+    if (slot == BITMAP_ERROR)
+        return stored;
+
+    // The slots are ours now, so concurrent swap-outs can queue
+    // their writes together and let the disk merge and sort them.
+    block_writev (swap_device, slot * SECTOR_PER_PAGE, iov, dev_cnt);
+    for (size_t i = 0; i < cnt; i++)
+        if (slots[i] == BITMAP_ERROR)
+            slots[i] = slot++;
+    return stored + dev_cnt;
 }
 
 /**
- * Swap in a page from swap device at given SLOT to KPAGE
+ * Swap in a page from swap at given SLOT to KPAGE
  */
 void swap_in (size_t slot, void *kpage)
 {
+    swap_in_cluster (slot, &kpage, 1);
+}
+
+/**
+ * Swap in the CNT pages in consecutive slots from SLOT on to the
+ * frames at KPAGES.  Those on the device are read with a single
+ * request.  The slots keep their copies until swap_free(), so that
+ * pages evicted again before they are written to need not go out
+ * again.
+ */
+void swap_in_cluster (size_t slot, void **kpages, size_t cnt)
+{
+    struct block_iovec iov[SWAP_CLUSTER];
+    size_t dev_cnt = 0;
+    ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+    /* Device slots come before the compressed ones */
+    for (; dev_cnt < cnt && slot + dev_cnt < dev_slots; dev_cnt++)
+    {
+        ASSERT (pg_ofs (kpages[dev_cnt]) == 0);
+        iov[dev_cnt].buffer = kpages[dev_cnt];
+        iov[dev_cnt].cnt = SECTOR_PER_PAGE;
+    }
+    if (dev_cnt > 0)
+        block_readv (swap_device, slot * SECTOR_PER_PAGE, iov, dev_cnt);
+    for (size_t i = dev_cnt; i < cnt; i++)
+        zswap_load (slot + i, kpages[i]);
+}
+
+/**
+ * Free swap SLOT
+ */
+void swap_free (size_t slot)
+{
+    if (slot >= dev_slots)
+    {
+        zswap_free (slot);
+        return;
+    }
     lock_acquire (&swap_lock);
     // Assert that the given slot is not empty
     ASSERT (bitmap_test (map, slot));
-    ASSERT (pg_ofs (kpage) == 0);
-    for (size_t i = 0; i < SECTOR_PER_PAGE; i++)
-        block_read (swap_device, slot * SECTOR_PER_PAGE + i,
-                    kpage + i * BLOCK_SECTOR_SIZE);
-    bitmap_flip (map, slot);
+    bitmap_reset (map, slot);
     lock_release (&swap_lock);
 }
+
+/**
+ * Compress the page at KPAGE into the compressed tier
+ * returns its slot, or BITMAP_ERROR if it compresses poorly or
+ * does not fit
+ */
+static size_t zswap_store (const void *kpage)
+{
+    size_t slot = BITMAP_ERROR;
+    lock_acquire (&zswap_lock);
+    size_t len = lz_compress (kpage, PGSIZE, zbuf, ZSWAP_MAX_LEN, zwork);
+    if (len == 0)
+        goto done;
+
+    /* Find a free entry */
+    size_t e = zentry_hint;
+    while (zentries[e].page != NULL)
+    {
+        e = (e + 1) % zentry_cnt;
+        if (e == zentry_hint)
+            goto done;
+    }
+
+    /* Start a new page if it does not fit in the open one */
+    if (zopen == NULL || PGSIZE - zopen->used < len)
+    {
+        struct zpage *zp = zpages;
+        while (zp < zpages + zpage_cnt && zp->base != NULL)
+            zp++;
+        if (zp == zpages + zpage_cnt
+            || (zp->base = palloc_get_page (0)) == NULL)
+            goto done;
+        zp->used = zp->live = 0;
+        if (zopen != NULL && zopen->live == 0)
+        {
+            palloc_free_page (zopen->base);
+            zopen->base = NULL;
+        }
+        zopen = zp;
+    }
+
+    memcpy (zopen->base + zopen->used, zbuf, len);
+    zentries[e].page = zopen;
+    zentries[e].ofs = zopen->used;
+    zentries[e].len = len;
+    zopen->used += len;
+    zopen->live++;
+    zentry_hint = (e + 1) % zentry_cnt;
+    slot = dev_slots + e;
+done:
+    lock_release (&zswap_lock);
+    return slot;
+}
+
+/**
+ * Decompress the page in compressed SLOT to KPAGE
+ */
+static void zswap_load (size_t slot, void *kpage)
+{
+    lock_acquire (&zswap_lock);
+    struct zentry *ze = zentries + (slot - dev_slots);
+    ASSERT (ze->page != NULL);
+    if (!lz_decompress (ze->page->base + ze->ofs, ze->len, kpage, PGSIZE))
+        PANIC ("zswap_load: slot %zu is corrupt", slot);
+    lock_release (&zswap_lock);
+}
+
+/**
+ * Free compressed SLOT, and the page holding it once it is empty
+ */
+static void zswap_free (size_t slot)
+{
+    lock_acquire (&zswap_lock);
+    struct zentry *ze = zentries + (slot - dev_slots);
+    struct zpage *zp = ze->page;
+    ASSERT (zp != NULL && zp->live > 0);
+    ze->page = NULL;
+    if (--zp->live == 0)
+    {
+        if (zp != zopen)
+        {
+            palloc_free_page (zp->base);
+            zp->base = NULL;
+        }
+        else
+            zp->used = 0;
+    }
+    lock_release (&zswap_lock);
+}
@@ -1,4 +1,12 @@
 #include <stdio.h>
+#include <stddef.h>
+
+/* most pages written or read around with one swap request */
+#define SWAP_CLUSTER 8
+
 void swap_init (void);
 size_t swap_out (void*);
+size_t swap_out_cluster (void**, size_t, size_t*);
 void swap_in (size_t, void*);
+void swap_in_cluster (size_t, void**, size_t);
+void swap_free (size_t);